@@ -0,0 +1,366 @@
+// bench.c
+//
+// Times ed2's core operations on generated files.
+//
+// Usage:
+//   bench [-l] [-f "ed2 options"] [-r repeats] path/to/ed2 [num_lines ...]
+//
+// For each number of lines (1000, 10000 and 100000 by default) and each
+// line-length distribution, this writes a file of random words, opens it with
+// ed2 over pipes, and runs a fixed sequence of commands. Each command is timed
+// from when it's sent until ed2 answers a marker sent after it; the marker is
+// an unknown command with error messages on, so its answer is a line that no
+// generated file contains.
+//
+// Each result is printed as one JSON object per line, with the median and
+// slowest of its repeats, the resident memory of ed2 afterwards, and, for
+// commands that go over the whole buffer, throughput in lines and megabytes
+// per second.
+//
+// With -l, only loading and saving are timed, for 1 and 10 million lines by
+// default, each with io_uring and with the I/O thread of ed2 -u; a new ed2 is
+// started for each repeat. Where ed2 can't use io_uring, both use the thread.
+// The page cache isn't dropped between runs, so for cold-cache numbers run
+// this as root and write 3 to /proc/sys/vm/drop_caches before each run.
+//
+
+#include "gen.h"
+
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+#define max_repeats 1000
+#define marker      "H\nZ\nH\n"
+#define marker_echo "unknown command\n"
+
+// This is a running ed2 and what the bench knows about its buffer.
+typedef struct {
+  pid_t   pid;
+  FILE *  in;
+  FILE *  out;
+  int64_t num_lines;
+  int64_t num_bytes;
+} Editor;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+static char *ed2_path    = NULL;
+static char *ed2_options = "";
+static int   num_repeats = 10;
+static int   is_io_only  = 0;
+static char  data_dir[]  = "/tmp/ed2_bench_XXXXXX";
+
+// The output of ed2 is read into this.
+static char *  out_line     = NULL;
+static size_t  out_capacity = 0;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// This reads ed2's output up to the answer to a marker. It returns 0 if ed2
+// exited first.
+static int read_to_marker(Editor *ed) {
+  while (getline(&out_line, &out_capacity, ed->out) != -1) {
+    if (strcmp(out_line, marker_echo) == 0) return 1;
+  }
+  return 0;
+}
+
+// Returns ed2's resident memory in megabytes, or -1 if it's unknown.
+static int64_t rss_mb(Editor *ed) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/status", (int)ed->pid);
+  FILE *f = fopen(path, "r");
+  if (f == NULL) return -1;
+  char    line[256];
+  int64_t kb = -1;
+  while (fgets(line, sizeof(line), f)) {
+    if (strncmp(line, "VmRSS:", 6) == 0) kb = strtoll(line + 6, NULL, 10);
+  }
+  fclose(f);
+  return kb < 0 ? -1 : kb / 1024;
+}
+
+// This asks ed2 how many lines its buffer has.
+static void update_num_lines(Editor *ed) {
+  fprintf(ed->in, "=\n%s", marker);
+  fflush(ed->in);
+  while (getline(&out_line, &out_capacity, ed->out) != -1) {
+    if (strcmp(out_line, marker_echo) == 0) return;
+    char *end;
+    int64_t num_lines = strtoll(out_line, &end, 10);
+    if (end != out_line && *end == '\n') ed->num_lines = num_lines;
+  }
+}
+
+static void start_editor(Editor *ed, char *path) {
+  int to_ed2[2], from_ed2[2];
+  if (pipe(to_ed2) || pipe(from_ed2)) {
+    perror("pipe");
+    exit(1);
+  }
+  ed->pid = fork();
+  if (ed->pid == 0) {
+    dup2(to_ed2[0],   0);
+    dup2(from_ed2[1], 1);
+    close(to_ed2[1]);
+    close(from_ed2[0]);
+    char *argv[32];
+    int   argc = 0;
+    char *options = strdup(ed2_options);
+    argv[argc++] = ed2_path;
+    for (char *opt = strtok(options, " "); opt && argc < 30;
+         opt = strtok(NULL, " ")) {
+      argv[argc++] = opt;
+    }
+    argv[argc++] = path;
+    argv[argc]   = NULL;
+    execv(ed2_path, argv);
+    perror(ed2_path);
+    exit(1);
+  }
+  close(to_ed2[0]);
+  close(from_ed2[1]);
+  ed->in  = fdopen(to_ed2[1], "w");
+  ed->out = fdopen(from_ed2[0], "r");
+}
+
+// This starts ed2 on `path` and returns the seconds until it has loaded it,
+// which is when it answers the first marker.
+static double start_and_load(Editor *ed, char *path) {
+  double start = now();
+  start_editor(ed, path);
+  fprintf(ed->in, "%s", marker);
+  fflush(ed->in);
+  if (!read_to_marker(ed)) {
+    fprintf(stderr, "ed2 exited while loading\n");
+    exit(1);
+  }
+  return now() - start;
+}
+
+static void stop_editor(Editor *ed) {
+  fprintf(ed->in, "q\nq\n");
+  fclose(ed->in);
+  fclose(ed->out);
+  waitpid(ed->pid, NULL, 0);
+}
+
+// This sends `command`, which may span lines, and returns the seconds until
+// ed2 has answered it.
+static double time_command(Editor *ed, char *command) {
+  double start = now();
+  fprintf(ed->in, "%s\n%s", command, marker);
+  fflush(ed->in);
+  if (!read_to_marker(ed)) {
+    fprintf(stderr, "ed2 exited during: %s\n", command);
+    exit(1);
+  }
+  return now() - start;
+}
+
+static int compare_doubles(const void *a_vp, const void *b_vp) {
+  double a = *(const double *)a_vp;
+  double b = *(const double *)b_vp;
+  return (a > b) - (a < b);
+}
+
+// This prints one result. Throughput is only given for whole-buffer commands.
+static void report(Editor *ed, char *op, gen__Distribution *dist,
+                   int64_t size, double *seconds, int n, int is_whole_buffer) {
+  qsort(seconds, n, sizeof(double), compare_doubles);
+  double median = seconds[n / 2];
+  printf("{\"op\": \"%s\", \"dist\": \"%s\", \"lines\": %" PRId64 ", "
+         "\"repeats\": %d, \"median_s\": %.6f, \"max_s\": %.6f, "
+         "\"rss_mb\": %" PRId64,
+         op, dist->name, size, n, median, seconds[n - 1], rss_mb(ed));
+  if (is_whole_buffer && median > 0) {
+    printf(", \"lines_per_s\": %.0f, \"mb_per_s\": %.1f",
+           ed->num_lines / median, ed->num_bytes / median / (1 << 20));
+  }
+  printf("}\n");
+  fflush(stdout);
+}
+
+// This times a whole-buffer command once.
+static void bench_once(Editor *ed, char *op, char *command,
+                       gen__Distribution *dist, int64_t size) {
+  double seconds = time_command(ed, command);
+  report(ed, op, dist, size, &seconds, 1, 1);
+}
+
+// These time the point commands at the first, middle and last lines.
+static void bench_point_commands(Editor *ed, gen__Distribution *dist,
+                                 int64_t size) {
+  static char *where_names[] = { "head", "middle", "tail" };
+  char   command[256];
+  char   op[64];
+  double a_times[max_repeats], d_times[max_repeats];
+  double m_times[max_repeats], j_times[max_repeats];
+  for (int where = 0; where < 3; ++where) {
+    for (int r = 0; r < num_repeats; ++r) {
+      // Each a is undone by a d of the same line; each j leaves one line
+      // fewer.
+      int64_t n    = ed->num_lines;
+      int64_t line = where == 0 ? 1 : where == 1 ? n / 2 : n - 20;
+      snprintf(command, sizeof(command), "%" PRId64 "a\nbench line\n.", line);
+      a_times[r] = time_command(ed, command);
+      snprintf(command, sizeof(command), "%" PRId64 "d", line + 1);
+      d_times[r] = time_command(ed, command);
+      snprintf(command, sizeof(command), "%" PRId64 ",%" PRId64 "m%" PRId64,
+               line, line + 9, line + 19);
+      m_times[r] = time_command(ed, command);
+      snprintf(command, sizeof(command), "%" PRId64 "j", line);
+      j_times[r] = time_command(ed, command);
+      ed->num_lines--;
+    }
+    snprintf(op, sizeof(op), "a_%s", where_names[where]);
+    report(ed, op, dist, size, a_times, num_repeats, 0);
+    snprintf(op, sizeof(op), "d_%s", where_names[where]);
+    report(ed, op, dist, size, d_times, num_repeats, 0);
+    snprintf(op, sizeof(op), "m_%s", where_names[where]);
+    report(ed, op, dist, size, m_times, num_repeats, 0);
+    snprintf(op, sizeof(op), "j_%s", where_names[where]);
+    report(ed, op, dist, size, j_times, num_repeats, 0);
+  }
+}
+
+static void bench_file(int64_t size, gen__Distribution *dist) {
+  char path[64], save_path[64];
+  snprintf(path, sizeof(path), "%s/in.txt", data_dir);
+  snprintf(save_path, sizeof(save_path), "%s/out.txt", data_dir);
+
+  Editor ed;
+  ed.num_lines = size;
+  ed.num_bytes = gen__write_file(path, size, dist);
+
+  double seconds = start_and_load(&ed, path);
+  update_num_lines(&ed);
+  report(&ed, "load", dist, size, &seconds, 1, 1);
+
+  bench_once(&ed, "p", ",p", dist, size);
+  bench_once(&ed, "n", ",n", dist, size);
+  bench_point_commands(&ed, dist, size);
+  bench_once(&ed, "s_g", ",s/e/E/g", dist, size);
+  bench_once(&ed, "u_s", "u", dist, size);
+  bench_once(&ed, "g_d", "g/abc/d", dist, size);
+  bench_once(&ed, "u_g", "u", dist, size);
+  update_num_lines(&ed);
+  char command[128];
+  snprintf(command, sizeof(command), "w %s", save_path);
+  bench_once(&ed, "w", command, dist, size);
+
+  stop_editor(&ed);
+  remove(path);
+  remove(save_path);
+}
+
+// This times loading and saving with io_uring and then with ed2 -u.
+static void bench_io(int64_t size, gen__Distribution *dist) {
+  char path[64], save_path[64], command[128];
+  snprintf(path, sizeof(path), "%s/in.txt", data_dir);
+  snprintf(save_path, sizeof(save_path), "%s/out.txt", data_dir);
+  snprintf(command, sizeof(command), "w %s", save_path);
+  int64_t num_bytes = gen__write_file(path, size, dist);
+
+  char  thread_options[256];
+  snprintf(thread_options, sizeof(thread_options), "%s -u", ed2_options);
+  char *options[] = { ed2_options, thread_options };
+  char *names[]   = { "uring", "thread" };
+  for (int i = 0; i < 2; ++i) {
+    char *base_options = ed2_options;
+    ed2_options = options[i];
+    double load_times[max_repeats], save_times[max_repeats];
+    Editor ed;
+    for (int r = 0; r < num_repeats; ++r) {
+      if (r) stop_editor(&ed);
+      ed.num_lines  = size;
+      ed.num_bytes  = num_bytes;
+      load_times[r] = start_and_load(&ed, path);
+      save_times[r] = time_command(&ed, command);
+    }
+    update_num_lines(&ed);
+    char op[64];
+    snprintf(op, sizeof(op), "load_%s", names[i]);
+    report(&ed, op, dist, size, load_times, num_repeats, 1);
+    snprintf(op, sizeof(op), "w_%s", names[i]);
+    report(&ed, op, dist, size, save_times, num_repeats, 1);
+    stop_editor(&ed);
+    ed2_options = base_options;
+  }
+  remove(path);
+  remove(save_path);
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Main.
+
+int main(int argc, char **argv) {
+  int arg_index = 1;
+  for (; arg_index < argc && argv[arg_index][0] == '-'; ++arg_index) {
+    if (strcmp(argv[arg_index], "-l") == 0) {
+      is_io_only = 1;
+    } else if (arg_index + 1 >= argc) {
+      break;
+    } else if (strcmp(argv[arg_index], "-f") == 0) {
+      ed2_options = argv[++arg_index];
+    } else if (strcmp(argv[arg_index], "-r") == 0) {
+      num_repeats = atoi(argv[++arg_index]);
+    } else {
+      break;
+    }
+  }
+  if (arg_index >= argc || num_repeats < 1 || num_repeats > max_repeats) {
+    printf("usage: bench [-l] [-f \"ed2 options\"] [-r repeats] path/to/ed2 "
+           "[num_lines ...]\n");
+    return 1;
+  }
+  ed2_path = argv[arg_index++];
+
+  int64_t default_sizes[] = { 1000, 10000, 100000 };
+  int64_t io_sizes[]      = { 1000000, 10000000 };
+  int64_t *sizes     = is_io_only ? io_sizes : default_sizes;
+  int      num_sizes = is_io_only ? 2 : 3;
+  if (arg_index < argc) {
+    num_sizes = argc - arg_index;
+    sizes     = malloc(num_sizes * sizeof(int64_t));
+    for (int i = 0; i < num_sizes; ++i) {
+      sizes[i] = strtoll(argv[arg_index + i], NULL, 10);
+      if (sizes[i] < 40) sizes[i] = 40;  // The point commands need 40 lines.
+    }
+  }
+
+  if (mkdtemp(data_dir) == NULL) {
+    perror(data_dir);
+    return 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  for (int i = 0; i < num_sizes; ++i) {
+    for (int d = 0; d < gen__num_distributions; ++d) {
+      if (is_io_only) bench_io(sizes[i], &gen__distributions[d]);
+      else            bench_file(sizes[i], &gen__distributions[d]);
+    }
+  }
+  rmdir(data_dir);
+  return 0;
+}
@@ -0,0 +1,401 @@
+// compare.c
+//
+// Runs the same scripts through ed2 and another ed and compares the results.
+//
+// Usage:
+//   compare [-f "ed2 options"] [-t seconds] [-d distribution]
+//           path/to/ed2 [path/to/ed] [num_lines ...]
+//
+// For each number of lines (1000 and 100000 by default), this writes a file
+// of random words with the given line-length distribution, "medium" by
+// default, and runs each script on its own copy of the file with each editor,
+// with the script as stdin. The other editor is `ed` from the PATH unless a
+// path is given.
+//
+// Each run is stopped after `seconds`, 60 by default. Each script gives one
+// JSON object per line with the wall time and peak resident memory of both
+// editors, and whether their output and the files they wrote are the same.
+// ed2 echoes its input when it isn't a terminal, so lines of output that match
+// the script's lines, in order, are left out before the outputs are compared.
+// When anything differs, the runs are left in place and their directory is
+// printed to stderr.
+//
+// Giving ed2 itself as the other ed compares ed2 with and without options;
+// for example, `compare -f -d ./ed2 ./ed2` checks that sharing lines with -d
+// doesn't change what any script does.
+//
+
+#include "gen.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+// These say which numbers a script's format is given.
+typedef enum { none, half, quarter } Arg;
+
+// Each format is given its args as int64_t values. The double_chars and
+// global_delete scripts are the pathological ones: they touch every line of a
+// large file, and a g command that runs once per line can be quadratic.
+typedef struct {
+  char *name;
+  char *format;
+  Arg   arg1;
+  Arg   arg2;
+} Script;
+
+static Script scripts[] = {
+  { "print",         ",p\nq\n",                            none,    none },
+  { "number",        ",n\nq\n",                            none,    none },
+  { "search",        "/abc/\n//\n?abc?\nq\n",              none,    none },
+  { "subst",         ",s/e/E/g\nw\nq\n",                   none,    none },
+  { "subst_undo",    ",s/a/b/g\nu\nw\nq\n",                none,    none },
+  { "double_chars",  ",s/./&&/g\nw\nq\n",                  none,    none },
+  { "global_subst",  "g/ab/s/a/A/g\nw\nq\n",               none,    none },
+  { "global_delete", "g/./d\nw\nq\n",                      none,    none },
+  // With -d, line 1 shares its string with line 4 but is outside the range.
+  { "global_range",  "1i\nab\n.\n3a\nab\n.\n4,%" PRId64 "g/ab/d\nw\nq\n",
+                                                          half,    none },
+  { "delete_half",   "1,%" PRId64 "d\nw\nq\n",             half,    none },
+  { "move",          "1,%" PRId64 "m%" PRId64 "\nw\nq\n",  quarter, half },
+  { "join",          "1,%" PRId64 "j\nw\nq\n",             quarter, none },
+  { "append",        "%" PRId64 "a\nnew line\n.\nw\nq\n",  half,    none },
+  { "change",        "%" PRId64 "c\nchanged\n.\nw\nq\n",   half,    none }
+};
+#define num_scripts (int)(sizeof(scripts) / sizeof(scripts[0]))
+
+// This is how one editor did on one script.
+typedef struct {
+  double  seconds;
+  int64_t peak_rss_mb;
+  char    status[16];  // This is "ok", "timeout", "crash" or "exit <code>".
+} Run;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+static char *ed2_path    = NULL;
+static char *ed_path     = "ed";
+static char *ed2_options = "";
+static int   timeout_s   = 60;
+static char  data_dir[]  = "/tmp/ed2_compare_XXXXXX";
+
+static volatile sig_atomic_t did_time_out;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_alarm(int signal_number) {
+  did_time_out = 1;
+}
+
+static int64_t arg_value(Arg arg, int64_t num_lines) {
+  if (arg == half)    return num_lines / 2;
+  if (arg == quarter) return num_lines / 4;
+  return 0;
+}
+
+// This returns the malloc'd contents of `path`, setting *len, or NULL if it
+// can't be read.
+static char *read_whole_file(char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return NULL;
+  size_t capacity = 1 << 16;
+  char * bytes    = malloc(capacity);
+  *len = 0;
+  size_t n;
+  while ((n = fread(bytes + *len, 1, capacity - *len, f)) > 0) {
+    *len += n;
+    if (*len == capacity) bytes = realloc(bytes, capacity *= 2);
+  }
+  fclose(f);
+  return bytes;
+}
+
+static void write_whole_file(char *path, char *bytes, size_t len) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL || fwrite(bytes, 1, len, f) != len) {
+    perror(path);
+    exit(1);
+  }
+  fclose(f);
+}
+
+// This drops the lines of `output` that echo the lines of `script`, in order,
+// in place, and returns the new length.
+static size_t drop_echoed_lines(char *output, size_t len, char *script) {
+  char *in  = output;
+  char *out = output;
+  char *end = output + len;
+  while (in < end) {
+    char * newline  = memchr(in, '\n', end - in);
+    size_t line_len = newline ? newline - in + 1 : end - in;
+    char * script_newline = strchr(script, '\n');
+    size_t script_len     = script_newline ? script_newline - script + 1 : 0;
+    if (script_len && line_len == script_len &&
+        memcmp(in, script, line_len) == 0) {
+      script += script_len;
+    } else {
+      memmove(out, in, line_len);
+      out += line_len;
+    }
+    in += line_len;
+  }
+  return out - output;
+}
+
+// This runs `editor` in `dir` on file.txt with script.txt as its input and
+// output.txt as its output.
+static Run run_editor(char *editor, char *options, char *dir) {
+  Run    run   = { .status = "ok" };
+  double start = now();
+  pid_t  pid   = fork();
+  if (pid == 0) {
+    if (chdir(dir) != 0) exit(127);
+    int in  = open("script.txt", O_RDONLY);
+    int out = open("output.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in == -1 || out == -1) exit(127);
+    dup2(in, 0);
+    dup2(out, 1);
+    dup2(out, 2);
+    char *argv[32];
+    int   argc = 0;
+    argv[argc++] = editor;
+    char *opts = strdup(options);
+    for (char *opt = strtok(opts, " "); opt && argc < 30;
+         opt = strtok(NULL, " ")) {
+      argv[argc++] = opt;
+    }
+    argv[argc++] = "file.txt";
+    argv[argc]   = NULL;
+    execvp(editor, argv);
+    exit(127);
+  }
+
+  did_time_out = 0;
+  alarm(timeout_s);
+  int           status;
+  struct rusage usage;
+  while (wait4(pid, &status, 0, &usage) == -1) {
+    if (errno != EINTR) {
+      perror("wait4");
+      exit(1);
+    }
+    if (did_time_out) kill(pid, SIGKILL);
+  }
+  alarm(0);
+  run.seconds = now() - start;
+
+  // On Mac OS X, ru_maxrss is in bytes; elsewhere it's in kilobytes.
+#ifdef __APPLE__
+  run.peak_rss_mb = usage.ru_maxrss >> 20;
+#else
+  run.peak_rss_mb = usage.ru_maxrss >> 10;
+#endif
+
+  if (did_time_out) {
+    strcpy(run.status, "timeout");
+  } else if (WIFSIGNALED(status)) {
+    strcpy(run.status, "crash");
+  } else if (WEXITSTATUS(status) != 0) {
+    snprintf(run.status, sizeof(run.status), "exit %d", WEXITSTATUS(status));
+  }
+  return run;
+}
+
+// This returns 1 if the two files hold the same bytes, after echoed lines
+// are dropped when `script` is given.
+static int are_same(char *path1, char *path2, char *script) {
+  size_t len1, len2;
+  char * bytes1 = read_whole_file(path1, &len1);
+  char * bytes2 = read_whole_file(path2, &len2);
+  int    same   = 0;
+  if (bytes1 && bytes2) {
+    if (script) {
+      len1 = drop_echoed_lines(bytes1, len1, script);
+      len2 = drop_echoed_lines(bytes2, len2, script);
+    }
+    same = (len1 == len2 && memcmp(bytes1, bytes2, len1) == 0);
+  }
+  free(bytes1);
+  free(bytes2);
+  return same;
+}
+
+static void print_run(char *prefix, Run *run) {
+  printf(", \"%s_s\": %.3f, \"%s_rss_mb\": %" PRId64 ", \"%s_status\": \"%s\"",
+         prefix, run->seconds, prefix, run->peak_rss_mb, prefix, run->status);
+}
+
+static void remove_run_dir(char *dir) {
+  char *names[] = { "file.txt", "output.txt", "script.txt" };
+  char  path[1024];
+  for (int i = 0; i < 3; ++i) {
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    remove(path);
+  }
+  rmdir(dir);
+}
+
+// This runs one script through both editors and prints the result. It
+// returns 0 if the editors disagreed; a run that timed out can't disagree.
+static int compare_script(Script *script, char *input, size_t input_len,
+                          int64_t num_lines, gen__Distribution *dist) {
+  char text[512];
+  snprintf(text, sizeof(text), script->format,
+           arg_value(script->arg1, num_lines),
+           arg_value(script->arg2, num_lines));
+
+  char dirs[2][512];
+  Run  runs[2];
+  char *editors[2] = { ed2_path, ed_path };
+  char *options[2] = { ed2_options, "" };
+  char *names[2]   = { "ed2", "ed" };
+  char  path[1024];
+  char  case_dir[256];
+  snprintf(case_dir, sizeof(case_dir), "%s/%s_%" PRId64,
+           data_dir, script->name, num_lines);
+  mkdir(case_dir, 0755);
+  for (int i = 0; i < 2; ++i) {
+    snprintf(dirs[i], sizeof(dirs[i]), "%s/%s", case_dir, names[i]);
+    mkdir(dirs[i], 0755);
+    snprintf(path, sizeof(path), "%s/file.txt", dirs[i]);
+    write_whole_file(path, input, input_len);
+    snprintf(path, sizeof(path), "%s/script.txt", dirs[i]);
+    write_whole_file(path, text, strlen(text));
+    runs[i] = run_editor(editors[i], options[i], dirs[i]);
+  }
+
+  int is_done = strcmp(runs[0].status, "timeout") != 0 &&
+                strcmp(runs[1].status, "timeout") != 0;
+  char path2[1024];
+  snprintf(path,  sizeof(path),  "%s/output.txt", dirs[0]);
+  snprintf(path2, sizeof(path2), "%s/output.txt", dirs[1]);
+  int same_output = are_same(path, path2, text);
+  snprintf(path,  sizeof(path),  "%s/file.txt", dirs[0]);
+  snprintf(path2, sizeof(path2), "%s/file.txt", dirs[1]);
+  int same_file = are_same(path, path2, NULL);
+
+  printf("{\"script\": \"%s\", \"dist\": \"%s\", \"lines\": %" PRId64,
+         script->name, dist->name, num_lines);
+  print_run("ed2", &runs[0]);
+  print_run("ed",  &runs[1]);
+  if (is_done) {
+    printf(", \"same_output\": %s, \"same_file\": %s",
+           same_output ? "true" : "false", same_file ? "true" : "false");
+  }
+  printf("}\n");
+  fflush(stdout);
+
+  int did_agree = !is_done || (same_output && same_file &&
+                               strcmp(runs[0].status, runs[1].status) == 0);
+  if (did_agree) {
+    for (int i = 0; i < 2; ++i) remove_run_dir(dirs[i]);
+    rmdir(case_dir);
+  } else {
+    fprintf(stderr, "%s: the runs are in %s\n", script->name, case_dir);
+  }
+  return did_agree;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Main.
+
+int main(int argc, char **argv) {
+  gen__Distribution *dist = gen__find_distribution("medium");
+
+  int arg_index = 1;
+  for (; arg_index < argc && argv[arg_index][0] == '-'; arg_index += 2) {
+    if (arg_index + 1 >= argc) break;
+    if (strcmp(argv[arg_index], "-f") == 0) {
+      ed2_options = argv[arg_index + 1];
+    } else if (strcmp(argv[arg_index], "-t") == 0) {
+      timeout_s = atoi(argv[arg_index + 1]);
+    } else if (strcmp(argv[arg_index], "-d") == 0) {
+      dist = gen__find_distribution(argv[arg_index + 1]);
+    } else {
+      break;
+    }
+  }
+  if (arg_index >= argc || timeout_s < 1 || dist == NULL) {
+    printf("usage: compare [-f \"ed2 options\"] [-t seconds] "
+           "[-d short|medium|mixed]\n"
+           "               path/to/ed2 [path/to/ed] [num_lines ...]\n");
+    return 1;
+  }
+  ed2_path = argv[arg_index++];
+  if (arg_index < argc && strspn(argv[arg_index], "0123456789") == 0) {
+    ed_path = argv[arg_index++];
+  }
+
+  int64_t default_sizes[] = { 1000, 100000 };
+  int64_t *sizes     = default_sizes;
+  int      num_sizes = 2;
+  if (arg_index < argc) {
+    num_sizes = argc - arg_index;
+    sizes     = malloc(num_sizes * sizeof(int64_t));
+    for (int i = 0; i < num_sizes; ++i) {
+      sizes[i] = strtoll(argv[arg_index + i], NULL, 10);
+      if (sizes[i] < 4) sizes[i] = 4;  // The scripts need nonzero quarters.
+    }
+  }
+
+  // The editors are given a path relative to the directory they run in, so
+  // ed2's own path has to be absolute.
+  char ed2_abs_path[4096];
+  if (strchr(ed2_path, '/') && realpath(ed2_path, ed2_abs_path)) {
+    ed2_path = ed2_abs_path;
+  }
+  char ed_abs_path[4096];
+  if (strchr(ed_path, '/') && realpath(ed_path, ed_abs_path)) {
+    ed_path = ed_abs_path;
+  }
+
+  if (mkdtemp(data_dir) == NULL) {
+    perror(data_dir);
+    return 1;
+  }
+  struct sigaction action = { .sa_handler = on_alarm };
+  sigaction(SIGALRM, &action, NULL);  // No SA_RESTART, so wait4 is stopped.
+
+  int  num_differences = 0;
+  char input_path[256];
+  snprintf(input_path, sizeof(input_path), "%s/input.txt", data_dir);
+  for (int i = 0; i < num_sizes; ++i) {
+    gen__write_file(input_path, sizes[i], dist);
+    size_t input_len;
+    char * input = read_whole_file(input_path, &input_len);
+    for (int s = 0; s < num_scripts; ++s) {
+      if (!compare_script(&scripts[s], input, input_len, sizes[i], dist)) {
+        num_differences++;
+      }
+    }
+    free(input);
+  }
+  remove(input_path);
+  if (num_differences == 0) rmdir(data_dir);
+  return num_differences ? 1 : 0;
+}
@@ -0,0 +1,425 @@
+// cstructs_bench.c
+//
+// Times the cstructs containers on their own.
+//
+// Usage:
+//   cstructs_bench [-s samples] [name_prefix ...]
+//
+// Each benchmark times one container operation at a few sizes. An operation
+// is repeated in batches large enough to be well above the clock's
+// resolution, and each batch gives one sample of the time per operation;
+// anything needed to put the container back as it was runs between samples,
+// outside the timing. An operation gets `samples` samples, 200 by default,
+// unless it's slow enough to stop after a second. With name prefixes, only
+// the benchmarks whose names start with one of them are run.
+//
+// Each result is printed as one JSON object per line with percentiles of the
+// samples in nanoseconds. The map results also give the map's load, the ratio
+// of its pairs to its slots.
+//
+
+#include "cstructs/cstructs.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+// A batch is made longer until it takes at least this long.
+#define min_batch_ns 20000
+#define max_batch    (1 << 20)
+
+// Slow operations stop early, after this many samples, once they've run for
+// this long.
+#define min_samples     20
+#define max_sampling_ns 1000000000
+
+// An Op is timed; it's given how many times it has run in this sample. A
+// Restore runs after each sample with how many times the op ran.
+typedef void (*Op)(int64_t iteration);
+typedef void (*Restore)(int64_t num_ops);
+
+static int64_t sizes[] = { 1000, 100000, 1000000 };
+#define num_sizes (int)(sizeof(sizes) / sizeof(sizes[0]))
+
+// Maps are measured at these loads, with this many slots.
+static double  loads[]     = { 0.41, 0.6, 0.79 };
+static int64_t map_slots[] = { 1 << 10, 1 << 17, 1 << 20 };
+#define num_loads (int)(sizeof(loads) / sizeof(loads[0]))
+#define num_map_sizes (int)(sizeof(map_slots) / sizeof(map_slots[0]))
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+static int     num_samples = 200;
+static char ** prefixes    = NULL;
+static int     num_prefixes = 0;
+
+static double *samples = NULL;
+
+// The state that ops work on.
+static Array   array;
+static int64_t position;   // Where array ops insert or remove,
+static int     is_at_tail; // unless they work at the end.
+static int64_t item;
+static Map     map;
+static int64_t num_keys;   // The map holds the keys 1 .. num_keys.
+static List    list;
+static void *  needle;
+
+static uint64_t random_state = 88172645463325252ull;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// This is xorshift64; every run sees the same numbers.
+static uint64_t next_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int is_wanted(char *name) {
+  if (num_prefixes == 0) return 1;
+  for (int i = 0; i < num_prefixes; ++i) {
+    if (strncmp(name, prefixes[i], strlen(prefixes[i])) == 0) return 1;
+  }
+  return 0;
+}
+
+static int compare_doubles(const void *a_vp, const void *b_vp) {
+  double a = *(double *)a_vp, b = *(double *)b_vp;
+  return (a > b) - (a < b);
+}
+
+// This is the nearest-rank percentile of the first n sorted samples.
+static double percentile(double p, int n) {
+  int rank = (int)(p / 100.0 * n + 0.999999);
+  if (rank < 1) rank = 1;
+  return samples[rank - 1];
+}
+
+// This runs `op` in batches of at most `batch_limit` and prints the
+// percentiles of its time per run. A load below zero isn't printed.
+static void measure(char *name, int64_t n, double load,
+                    Op op, Restore restore, int batch_limit) {
+  // Find a batch size that takes at least min_batch_ns.
+  int64_t batch = 1;
+  while (batch < batch_limit) {
+    int64_t start = now_ns();
+    for (int64_t i = 0; i < batch; ++i) op(i);
+    int64_t elapsed = now_ns() - start;
+    if (restore) restore(batch);
+    if (elapsed >= min_batch_ns) break;
+    batch *= 2;
+  }
+  if (batch > batch_limit) batch = batch_limit;
+
+  int     n_samples      = 0;
+  int64_t sampling_start = now_ns();
+  while (n_samples < num_samples) {
+    int64_t start = now_ns();
+    for (int64_t i = 0; i < batch; ++i) op(i);
+    samples[n_samples++] = (double)(now_ns() - start) / batch;
+    if (restore) restore(batch);
+    if (n_samples >= min_samples &&
+        now_ns() - sampling_start > max_sampling_ns) break;
+  }
+  qsort(samples, n_samples, sizeof(double), compare_doubles);
+
+  printf("{\"op\": \"%s\", \"n\": %" PRId64, name, n);
+  if (load >= 0) printf(", \"load\": %.2f", load);
+  printf(", \"samples\": %d, \"batch\": %" PRId64, n_samples, batch);
+  printf(", \"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f",
+         percentile(50, n_samples), percentile(90, n_samples),
+         percentile(99, n_samples));
+  printf(", \"max_ns\": %.1f}\n", samples[n_samples - 1]);
+  fflush(stdout);
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Array benchmarks.
+
+static void new_array(int64_t n, int is_gap_buffer) {
+  array = array__new(n, sizeof(int64_t));
+  array__set_gap_buffer(array, is_gap_buffer);
+  array__add_zeroed_items(array, n);
+  for (int64_t i = 0; i < n; ++i) array__item_val(array, i, int64_t) = i;
+}
+
+static void insert_one(int64_t iteration) {
+  array__insert_items(array, is_at_tail ? array->count : position, &item, 1);
+}
+
+static void remove_inserted(int64_t num_ops) {
+  array__remove_items(array, is_at_tail ? array->count - num_ops : position,
+                      num_ops);
+}
+
+static void remove_one(int64_t iteration) {
+  array__remove_items(array, is_at_tail ? array->count - 1 : position, 1);
+}
+
+static void reinsert_removed(int64_t num_ops) {
+  static Array zeros = NULL;
+  if (zeros == NULL) zeros = array__new(64, sizeof(int64_t));
+  array__clear(zeros);
+  array__add_zeroed_items(zeros, num_ops);
+  array__insert_items(array, is_at_tail ? array->count : position,
+                      zeros->items, num_ops);
+}
+
+// This inserts 1000 items at once, as a paste or a read into the middle of a
+// buffer does.
+static void insert_block(int64_t iteration) {
+  static int64_t block[1000];
+  array__insert_items(array, is_at_tail ? array->count : position, block,
+                      1000);
+}
+
+static void remove_blocks(int64_t num_ops) {
+  remove_inserted(num_ops * 1000);
+}
+
+static void bench_array_edits() {
+  char *where_names[] = { "head", "middle", "tail" };
+  char  name[64];
+  for (int gap = 0; gap < 2; ++gap) {
+    for (int w = 0; w < 3; ++w) {
+      for (int i = 0; i < num_sizes; ++i) {
+        int64_t n = sizes[i];
+        new_array(n, gap);
+        position   = (w == 0 ? 0 : n / 2);
+        is_at_tail = (w == 2);
+
+        snprintf(name, sizeof(name), "array_insert_%s%s",
+                 where_names[w], gap ? "_gap" : "");
+        if (is_wanted(name)) {
+          measure(name, n, -1, insert_one, remove_inserted, max_batch);
+        }
+
+        snprintf(name, sizeof(name), "array_remove_%s%s",
+                 where_names[w], gap ? "_gap" : "");
+        if (is_wanted(name)) {
+          measure(name, n, -1, remove_one, reinsert_removed, n / 4);
+        }
+
+        snprintf(name, sizeof(name), "array_insert_items_%s%s",
+                 where_names[w], gap ? "_gap" : "");
+        if (is_wanted(name)) {
+          measure(name, n, -1, insert_block, remove_blocks, 64);
+        }
+        array__delete(array);
+      }
+    }
+  }
+}
+
+static int compare_int64s(void *context, const void *a_vp, const void *b_vp) {
+  int64_t a = *(int64_t *)a_vp, b = *(int64_t *)b_vp;
+  return (a > b) - (a < b);
+}
+
+static int compare_strings(void *context, const void *a_vp, const void *b_vp) {
+  return strcmp(*(char **)a_vp, *(char **)b_vp);
+}
+
+static void sort_int64s(int64_t iteration) {
+  array__sort(array, compare_int64s, NULL);
+}
+
+static void sort_bytes(int64_t iteration) {
+  array__sort(array, NULL, NULL);
+}
+
+static void shuffle_int64s(int64_t num_ops) {
+  array__for(int64_t *, value, array, i) *value = next_random() >> 1;
+}
+
+static void sort_strings(int64_t iteration) {
+  array__sort(array, compare_strings, NULL);
+}
+
+// The strings are kept in a pool and their order is shuffled each sample.
+static void shuffle_strings(int64_t num_ops) {
+  char **items = (char **)array->items;
+  for (int64_t i = array->count - 1; i > 0; --i) {
+    int64_t j   = next_random() % (i + 1);
+    char *  tmp = items[i];
+    items[i]    = items[j];
+    items[j]    = tmp;
+  }
+}
+
+static void bench_array_sorts() {
+  for (int i = 0; i < num_sizes; ++i) {
+    int64_t n = sizes[i];
+    new_array(n, 0);
+    if (is_wanted("array_sort_int64")) {
+      shuffle_int64s(0);
+      measure("array_sort_int64", n, -1, sort_int64s, shuffle_int64s, 1);
+    }
+    if (is_wanted("array_sort_memcmp")) {
+      shuffle_int64s(0);
+      measure("array_sort_memcmp", n, -1, sort_bytes, shuffle_int64s, 1);
+    }
+    array__delete(array);
+
+    if (!is_wanted("array_sort_strings")) continue;
+    array = array__new(n, sizeof(char *));
+    char *pool = malloc(n * 24);
+    for (int64_t j = 0; j < n; ++j) {
+      char *s = pool + j * 24;
+      snprintf(s, 24, "line %" PRIu64, next_random() % 1000000000);
+      array__new_val(array, char *) = s;
+    }
+    shuffle_strings(0);
+    measure("array_sort_strings", n, -1, sort_strings, shuffle_strings, 1);
+    array__delete(array);
+    free(pool);
+  }
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Map benchmarks.
+
+// Keys are nonzero integers stored in the key pointers, as ed2 does with line
+// pointers.
+static int hash_key(void *key) {
+  return (int)(intptr_t)key;
+}
+
+static int eq_keys(void *key1, void *key2) {
+  return key1 == key2;
+}
+
+static void *key_at(int64_t k) {
+  return (void *)(intptr_t)k;
+}
+
+static void get_hit(int64_t iteration) {
+  map__get(map, key_at(1 + next_random() % num_keys));
+}
+
+static void get_miss(int64_t iteration) {
+  map__get(map, key_at(num_keys + 1 + next_random() % num_keys));
+}
+
+static void set_existing(int64_t iteration) {
+  map__set(map, key_at(1 + next_random() % num_keys), NULL);
+}
+
+// New keys are set and unset at once so the load stays the same.
+static void set_unset_new(int64_t iteration) {
+  void *key = key_at(num_keys + 1 + next_random() % num_keys);
+  map__set(map, key, NULL);
+  map__unset(map, key);
+}
+
+static void iterate(int64_t iteration) {
+  int64_t count = 0;
+  map__for(pair, map) count += (pair->key != NULL);
+  if (count != num_keys) abort();
+}
+
+static void bench_maps() {
+  char *names[] = {
+    "map_get_hit", "map_get_miss", "map_set_existing", "map_set_unset_new",
+    "map_iterate"
+  };
+  Op ops[] = { get_hit, get_miss, set_existing, set_unset_new, iterate };
+  for (int i = 0; i < num_map_sizes; ++i) {
+    for (int j = 0; j < num_loads; ++j) {
+      map      = map__new(hash_key, eq_keys);
+      num_keys = (int64_t)(loads[j] * map_slots[i]);
+      for (int64_t k = 1; k <= num_keys; ++k) map__set(map, key_at(k), NULL);
+      double load = (double)map->count / map->slots->count;
+      for (int k = 0; k < 5; ++k) {
+        if (!is_wanted(names[k])) continue;
+        measure(names[k], num_keys, load, ops[k], NULL,
+                ops[k] == iterate ? 1 : max_batch);
+      }
+      map__delete(map);
+    }
+  }
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// List benchmarks.
+
+static void insert_remove_first(int64_t iteration) {
+  list__insert(&list, needle);
+  list__remove_first(&list);
+}
+
+static int eq_pointers(void *value, void *needle) {
+  return value == needle;
+}
+
+static void find_last(int64_t iteration) {
+  if (list__find_value(&list, needle, eq_pointers) != needle) abort();
+}
+
+static void bench_lists() {
+  for (int i = 0; i < num_sizes; ++i) {
+    int64_t n = sizes[i];
+    list = NULL;
+    for (int64_t k = 1; k <= n; ++k) list__insert(&list, key_at(k));
+    needle = key_at(1);  // This is the last item.
+    if (is_wanted("list_insert_remove_first")) {
+      measure("list_insert_remove_first", n, -1, insert_remove_first, NULL,
+              max_batch);
+    }
+    if (is_wanted("list_find_last")) {
+      measure("list_find_last", n, -1, find_last, NULL, max_batch);
+    }
+    list__delete(&list);
+  }
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Main.
+
+int main(int argc, char **argv) {
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; ++i) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      num_samples = atoi(argv[++i]);
+    } else {
+      break;
+    }
+  }
+  if (num_samples < 1 || (i < argc && argv[i][0] == '-')) {
+    fprintf(stderr, "usage: cstructs_bench [-s samples] [name_prefix ...]\n");
+    return 1;
+  }
+  prefixes     = argv + i;
+  num_prefixes = argc - i;
+  samples      = malloc(num_samples * sizeof(double));
+
+  bench_array_edits();
+  bench_array_sorts();
+  bench_maps();
+  bench_lists();
+
+  free(samples);
+  return 0;
+}
@@ -0,0 +1,76 @@
+// gen.c
+//
+
+// Header for this file.
+#include "gen.h"
+
+// Standard includes.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+gen__Distribution gen__distributions[] = {
+  { "short",  0,  16, 0 },
+  { "medium", 20, 100, 0 },
+  { "mixed",  0,  80, 50 }
+};
+int gen__num_distributions =
+    (int)(sizeof(gen__distributions) / sizeof(gen__distributions[0]));
+
+static uint64_t random_state = 88172645463325252ull;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// This is xorshift64.
+static uint64_t next_random() {
+  random_state ^= random_state << 13;
+  random_state ^= random_state >> 7;
+  random_state ^= random_state << 17;
+  return random_state;
+}
+
+static int random_in(int min, int max) {
+  return min + (int)(next_random() % (uint64_t)(max - min + 1));
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+gen__Distribution *gen__find_distribution(char *name) {
+  for (int i = 0; i < gen__num_distributions; ++i) {
+    if (strcmp(gen__distributions[i].name, name) == 0) {
+      return &gen__distributions[i];
+    }
+  }
+  return NULL;
+}
+
+int64_t gen__write_file(char *path, int64_t num_lines,
+                        gen__Distribution *dist) {
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  char    line[8192];
+  int64_t num_bytes = 0;
+  for (int64_t i = 0; i < num_lines; ++i) {
+    int len = random_in(dist->min_len, dist->max_len);
+    if (random_in(1, 1000) <= dist->long_per_1000) len = random_in(1000, 8000);
+    for (int k = 0; k < len; ++k) {
+      line[k] = random_in(0, 6) ? 'a' + random_in(0, 25) : ' ';
+    }
+    line[len] = '\n';
+    fwrite(line, 1, len + 1, f);
+    num_bytes += len + 1;
+  }
+  fclose(f);
+  return num_bytes;
+}
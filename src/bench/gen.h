@@ -0,0 +1,43 @@
+// gen.h
+//
+// Generated input files for the benchmarks.
+//
+// Files are made of lines of random lowercase words whose lengths follow one
+// of a few distributions. The random numbers come from a fixed seed, so a run
+// writes the same files as the last one.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+typedef struct {
+  char *name;
+  int   min_len;  // Most lines have a length in [min_len, max_len].
+  int   max_len;
+  int   long_per_1000;  // This many lines per 1000 are 1000 to 8000 bytes.
+} gen__Distribution;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public globals.
+
+// These are "short", "medium" and "mixed", in that order.
+extern gen__Distribution gen__distributions[];
+extern int               gen__num_distributions;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This returns the distribution called `name`, or NULL if there isn't one.
+gen__Distribution *gen__find_distribution(char *name);
+
+// This writes `num_lines` lines to `path` and returns the file size. It exits
+// if the file can't be written.
+int64_t gen__write_file(char *path, int64_t num_lines,
+                        gen__Distribution *dist);
@@ -0,0 +1,270 @@
+// replay.c
+//
+// Replays a session recorded with ed2 -r and compares its command times.
+//
+// Usage:
+//   replay [-f "ed2 options"] path/to/ed2 recording [filename]
+//
+// This runs ed2 in a scratch directory on a copy of the file the session
+// started with: `filename` if given, and otherwise the file named in the
+// recording. It warns if the file's hash differs from the recorded one. The
+// recorded input is given as stdin, with ed2's output thrown away, and ed2
+// records the replay in turn; ed2 runs with the recorded options unless -f
+// gives others. Files the session writes by relative name stay in the scratch
+// directory, which is removed afterwards, but a session that writes to an
+// absolute path writes there again.
+//
+// Each command is printed as one JSON object per line with its recorded and
+// replayed times in milliseconds, followed by the totals. A command without a
+// time, such as one that quit, has null times.
+//
+
+#include "cstructs/cstructs.h"
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+typedef struct {
+  char *  text;     // This is the command line.
+  Array   inputs;   // These are the lines read while it ran, as char *s.
+  int64_t time_us;  // This is -1 if the command has no time.
+} Command;
+
+typedef struct {
+  char *  options;
+  char *  filename;  // This is NULL if no file was loaded at the start.
+  char *  hash;
+  Array   commands;  // This is an Array of Command.
+} Recording;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+static char scratch_dir[] = "/tmp/ed2_replay_XXXXXX";
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static void fail(char *message, char *detail) {
+  fprintf(stderr, "replay: %s%s\n", message, detail);
+  exit(1);
+}
+
+// This reads a recording, exiting if it's not one.
+static Recording read_recording(char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) fail("can't read ", path);
+  Recording recording = { .options = "", .commands = NULL };
+  recording.commands  = array__new(64, sizeof(Command));
+
+  char *  line     = NULL;
+  size_t  capacity = 0;
+  ssize_t len;
+  if (getline(&line, &capacity, f) == -1 ||
+      strcmp(line, "ed2 recording 1\n") != 0) {
+    fail("not an ed2 recording: ", path);
+  }
+  Command *command = NULL;
+  while ((len = getline(&line, &capacity, f)) != -1) {
+    if (len < 2 || line[1] != ' ') continue;
+    line[len - 1] = '\0';  // This drops the newline.
+    char *rest = line + 2;
+    if (line[0] == 'o' && command == NULL) {
+      recording.options = strdup(rest);
+    } else if (line[0] == 'f' && command == NULL) {
+      // The entry is: f <hash> <size> <name>.
+      char *size = strchr(rest, ' ');
+      char *name = size ? strchr(size + 1, ' ') : NULL;
+      if (name == NULL) continue;
+      recording.hash     = strndup(rest, size - rest);
+      recording.filename = strdup(name + 1);
+    } else if (line[0] == 'c') {
+      command          = array__new_ptr(recording.commands);
+      command->text    = strdup(rest);
+      command->inputs  = array__new(4, sizeof(char *));
+      command->time_us = -1;
+    } else if (line[0] == 'i' && command) {
+      array__new_val(command->inputs, char *) = strdup(rest);
+    } else if (line[0] == 't' && command) {
+      command->time_us = strtoll(rest, NULL, 10);
+    }
+  }
+  free(line);
+  fclose(f);
+  return recording;
+}
+
+// This returns the FNV-1a hash of the file at `path` in hex, as ed2 -r
+// records it, or NULL if the file can't be read.
+static char *hash_of_file(char *path) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return NULL;
+  uint64_t h = 14695981039346656037ull;
+  int      c;
+  while ((c = getc(f)) != EOF) h = (h ^ (unsigned char)c) * 1099511628211ull;
+  fclose(f);
+  char *hash = malloc(17);
+  snprintf(hash, 17, "%016" PRIx64, h);
+  return hash;
+}
+
+static void copy_file(char *from, char *to) {
+  FILE *in  = fopen(from, "rb");
+  FILE *out = fopen(to, "wb");
+  if (in == NULL)  fail("can't read ", from);
+  if (out == NULL) fail("can't write ", to);
+  char   buffer[1 << 16];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    fwrite(buffer, 1, n, out);
+  }
+  fclose(in);
+  fclose(out);
+}
+
+// This writes the recorded input, as ed2 read it, to `path`.
+static void write_input(Recording *recording, char *path) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) fail("can't write ", path);
+  array__for(Command *, command, recording->commands, i) {
+    fprintf(f, "%s\n", command->text);
+    array__for(char **, input, command->inputs, j) fprintf(f, "%s\n", *input);
+  }
+  fclose(f);
+}
+
+// This runs ed2 in the scratch directory with input.txt as its input,
+// recording to replay.txt.
+static void run_ed2(char *ed2_path, char *options, char *filename) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    if (chdir(scratch_dir) != 0) exit(127);
+    int in  = open("input.txt", O_RDONLY);
+    int out = open("/dev/null", O_WRONLY);
+    if (in == -1 || out == -1) exit(127);
+    dup2(in, 0);
+    dup2(out, 1);
+    dup2(out, 2);
+    char *argv[32];
+    int   argc = 0;
+    argv[argc++] = ed2_path;
+    for (char *opt = strtok(options, " "); opt && argc < 28;
+         opt = strtok(NULL, " ")) {
+      argv[argc++] = opt;
+    }
+    argv[argc++] = "-r";
+    argv[argc++] = "replay.txt";
+    if (filename) argv[argc++] = filename;
+    argv[argc] = NULL;
+    execv(ed2_path, argv);
+    exit(127);
+  }
+  // ed2 may end with an error when its input runs out; that's expected.
+  waitpid(pid, NULL, 0);
+}
+
+static void print_json_string(char *s) {
+  putchar('"');
+  for (unsigned char *c = (unsigned char *)s; *c; ++c) {
+    if (*c == '"' || *c == '\\') {
+      printf("\\%c", *c);
+    } else if (*c < 0x20) {
+      printf("\\u%04x", *c);
+    } else {
+      putchar(*c);
+    }
+  }
+  putchar('"');
+}
+
+static void print_ms(char *name, int64_t time_us) {
+  if (time_us < 0) printf(", \"%s\": null", name);
+  else             printf(", \"%s\": %.3f", name, time_us / 1000.0);
+}
+
+static int remove_entry(const char *path, const struct stat *stats, int type,
+                        struct FTW *ftw) {
+  remove(path);
+  return 0;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Main.
+
+int main(int argc, char **argv) {
+  char *options   = NULL;
+  int   arg_index = 1;
+  if (arg_index + 1 < argc && strcmp(argv[arg_index], "-f") == 0) {
+    options    = argv[arg_index + 1];
+    arg_index += 2;
+  }
+  if (argc - arg_index < 2 || argc - arg_index > 3) {
+    printf("usage: replay [-f \"ed2 options\"] path/to/ed2 recording "
+           "[filename]\n");
+    return 1;
+  }
+  char ed2_path[4096];
+  if (realpath(argv[arg_index], ed2_path) == NULL) {
+    fail("can't find ", argv[arg_index]);
+  }
+  Recording recorded = read_recording(argv[arg_index + 1]);
+  if (options == NULL) options = recorded.options;
+  char *source = arg_index + 2 < argc ? argv[arg_index + 2] :
+                                        recorded.filename;
+
+  if (mkdtemp(scratch_dir) == NULL) fail("can't make ", scratch_dir);
+  char path[4096 + 64];
+  char *filename = NULL;
+  if (source) {
+    char *hash = hash_of_file(source);
+    if (hash == NULL) fail("can't read ", source);
+    if (recorded.hash && strcmp(hash, recorded.hash) != 0) {
+      fprintf(stderr, "replay: warning: %s differs from the recorded file\n",
+              source);
+    }
+    free(hash);
+    filename = strrchr(source, '/') ? strrchr(source, '/') + 1 : source;
+    snprintf(path, sizeof(path), "%s/%s", scratch_dir, filename);
+    copy_file(source, path);
+  }
+  snprintf(path, sizeof(path), "%s/input.txt", scratch_dir);
+  write_input(&recorded, path);
+
+  run_ed2(ed2_path, options, filename);
+  snprintf(path, sizeof(path), "%s/replay.txt", scratch_dir);
+  Recording replayed = read_recording(path);
+  nftw(scratch_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+  int64_t recorded_total = 0, replayed_total = 0;
+  array__for(Command *, command, recorded.commands, i) {
+    int64_t replayed_us = -1;
+    if (i < replayed.commands->count) {
+      replayed_us = array__item_val(replayed.commands, i, Command).time_us;
+    }
+    printf("{\"index\": %" PRId64 ", \"command\": ", i + 1);
+    print_json_string(command->text);
+    print_ms("recorded_ms", command->time_us);
+    print_ms("replay_ms", replayed_us);
+    printf("}\n");
+    if (command->time_us > 0) recorded_total += command->time_us;
+    if (replayed_us > 0)      replayed_total += replayed_us;
+  }
+  printf("{\"commands\": %" PRId64, recorded.commands->count);
+  print_ms("recorded_ms", recorded_total);
+  print_ms("replay_ms", replayed_total);
+  printf("}\n");
+  return 0;
+}
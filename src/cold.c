@@ -0,0 +1,712 @@
+// cold.c
+//
+
+// Header for this file.
+#include "cold.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+#include "ed2.h"
+#include "trace.h"
+
+// Standard includes.
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+// A chunk is packed once this many commands have gone by without using it.
+#define idle_commands    8
+
+// Besides the chunks known to be in use, each command after an edit looks over
+// this many more chunks, until all have been seen, for lines that edits have
+// shifted out of the chunks they were used in.
+#define sweep_chunks     64
+
+// Blocks hold at most this many bytes of lines; longer lines stay as they are.
+#define max_block_bytes  (1 << 30)
+
+#define cache_size       16
+#define prefetch_depth   4
+#define max_decoders     3
+
+// The codec's matches are found through a table of this many recent 4-byte
+// sequences, and may reach back this far.
+#define hash_bits        14
+#define max_offset       65535
+#define min_match        4
+#define copy_slack       16
+
+// A handle holds a line number within its block in these bits.
+#define line_bits        16
+
+// Packed blocks in memory are kept in a list from most to least recently
+// decoded. When they take more than the memory budget, the least recently
+// decoded are dropped from memory, after being written to the scratch file if
+// they aren't there yet. Blocks never change, so each is written at most once.
+typedef struct Block {
+  int64_t       num_refs;     // Handles to this block, plus decoders using it.
+  size_t        raw_len;      // This counts each line's null terminator.
+  size_t        packed_len;
+  char *        packed;       // This is NULL if it's only in the scratch file.
+  int64_t       file_offset;  // This is -1 if it's not in the scratch file.
+  int           num_lines;
+  int           num_readers;  // This many decoders are reading `packed`.
+  struct Block *newer;        // These link the list of blocks in memory.
+  struct Block *older;
+} Block;
+
+typedef struct {
+  int64_t    id;        // This is -1 if the entry is empty.
+  char *     raw;
+  uint32_t * starts;    // Line k starts at byte starts[k] of `raw`.
+  int        is_ready;  // This is 0 while the block is being decoded.
+  int        was_read;
+  uint64_t   last_use;
+} CacheEntry;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// These are guarded by cold_lock.
+static Array      blocks = NULL;  // Item i is the Block * with id i, or NULL.
+static CacheEntry cache[cache_size];
+static uint64_t   num_uses = 0;
+static int64_t    queue[prefetch_depth];  // Block ids waiting to be decoded.
+static int        num_queued      = 0;
+static int64_t    last_first_read = -1;  // Where a new block was first read.
+
+static size_t     budget       = SIZE_MAX;  // This limits packed_bytes.
+static size_t     packed_bytes = 0;         // This is for blocks in memory.
+static Block *    newest_block = NULL;
+static Block *    oldest_block = NULL;
+static FILE *     scratch_file = NULL;
+static int64_t    scratch_len  = 0;
+
+static pthread_mutex_t cold_lock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  did_decode = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  has_work   = PTHREAD_COND_INITIALIZER;
+
+// These are only used by the main thread. Item c of chunk_ticks is the tick
+// at which chunk c was last used, or 0 if it's known to hold no warm lines.
+static Array    chunk_ticks  = NULL;
+static uint32_t tick         = 1;
+static int64_t  next_sweep   = 0;
+static int64_t  num_to_sweep = 0;  // This many chunks are left to sweep.
+static int      did_edit     = 0;  // Set when lines are thawed or added.
+static int64_t  last_count   = 0;  // This is lines->count after a command.
+
+
+// ——————————————————————————————————————————————————————————————————————
+// The codec.
+
+// The packed form is a series of sequences, each with a token byte, some
+// literal bytes, and then a match to copy from earlier output. The token's
+// high 4 bits give the literal length and its low 4 bits the match length,
+// less min_match; a field of 15 is extended by bytes that are added to it,
+// ending with the first byte below 255. The match offset is 2 bytes, low byte
+// first. The last sequence ends after its literals.
+
+static uint32_t read32(const char *p) {
+  uint32_t word;
+  memcpy(&word, p, 4);
+  return word;
+}
+
+static uint64_t read64(const char *p) {
+  uint64_t word;
+  memcpy(&word, p, 8);
+  return word;
+}
+
+static uint32_t hash4(const char *p) {
+  return (read32(p) * 2654435761u) >> (32 - hash_bits);
+}
+
+static char *put_len(char *out, size_t len) {
+  for (; len >= 255; len -= 255) *out++ = (char)255;
+  *out++ = (char)len;
+  return out;
+}
+
+static char *put_sequence(char *out, const char *lit, size_t lit_len,
+                          size_t offset, size_t match_len) {
+  size_t match_field = match_len ? match_len - min_match : 0;
+  *out++ = (char)(((lit_len < 15 ? lit_len : 15) << 4) |
+                  (match_field < 15 ? match_field : 15));
+  if (lit_len >= 15) out = put_len(out, lit_len - 15);
+  memcpy(out, lit, lit_len);
+  out += lit_len;
+  if (match_len == 0) return out;
+  *out++ = (char)(offset & 0xff);
+  *out++ = (char)(offset >> 8);
+  if (match_field >= 15) out = put_len(out, match_field - 15);
+  return out;
+}
+
+// `out` needs room for max_packed_len(len) bytes.
+static size_t max_packed_len(size_t len) {
+  return len + len / 255 + 16;
+}
+
+// Like LZ4, this steps further between tries the longer it goes without a
+// match, so that data that won't compress goes by quickly.
+static size_t pack(const char *in, size_t len, char *out) {
+  uint32_t   *table  = calloc(1 << hash_bits, sizeof(uint32_t));
+  const char *end    = in + len;
+  const char *lit    = in;  // The start of the pending literals.
+  const char *p      = in;
+  char       *o      = out;
+  size_t      misses = 0;
+  while (p + min_match <= end) {
+    uint32_t    h    = hash4(p);
+    const char *cand = in + table[h];
+    table[h] = (uint32_t)(p - in);
+    if (cand < p && p - cand <= max_offset && read32(cand) == read32(p)) {
+      const char *q = p + min_match;
+      const char *c = cand + min_match;
+      while (q + 8 <= end && read64(q) == read64(c)) q += 8, c += 8;
+      while (q < end && *q == *c) q++, c++;
+      o      = put_sequence(o, lit, p - lit, p - cand, q - p);
+      p      = lit = q;
+      misses = 0;
+    } else {
+      p += 1 + (misses++ >> 6);
+    }
+  }
+  o = put_sequence(o, lit, end - lit, 0, 0);
+  free(table);
+  return o - out;
+}
+
+static size_t get_len(const unsigned char **p, size_t len) {
+  if (len < 15) return len;
+  unsigned char byte;
+  do {
+    byte = *(*p)++;
+    len += byte;
+  } while (byte == 255);
+  return len;
+}
+
+// Short copies are done a word at a time and may run past their ends, so both
+// `in` and `out` need copy_slack bytes of room after their data.
+static void unpack(const char *in, size_t packed_len, char *out) {
+  const unsigned char *p   = (const unsigned char *)in;
+  const unsigned char *end = p + packed_len;
+  char *o = out;
+  while (p < end) {
+    unsigned token   = *p++;
+    size_t   lit_len = get_len(&p, token >> 4);
+    if (lit_len <= copy_slack) memcpy(o, p, copy_slack);
+    else                       memcpy(o, p, lit_len);
+    o += lit_len;
+    p += lit_len;
+    if (p >= end) break;
+    size_t offset    = p[0] | (p[1] << 8);
+    p += 2;
+    size_t match_len = get_len(&p, token & 15) + min_match;
+    const char *from = o - offset;
+    if (offset >= 8) {
+      for (size_t i = 0; i < match_len; i += 8) memcpy(o + i, from + i, 8);
+    } else {
+      for (size_t i = 0; i < match_len; ++i) o[i] = from[i];  // It overlaps.
+    }
+    o += match_len;
+  }
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Handles and blocks.
+
+static char *make_handle(int64_t id, int line_in_block) {
+  uint64_t bits = ((uint64_t)id << (line_bits + 1)) |
+                  ((uint64_t)line_in_block << 1) | 1;
+  return (char *)(uintptr_t)bits;
+}
+
+static int64_t block_id(char *handle) {
+  return (int64_t)((uint64_t)(uintptr_t)handle >> (line_bits + 1));
+}
+
+static int line_in_block(char *handle) {
+  return (int)(((uintptr_t)handle >> 1) & ((1 << line_bits) - 1));
+}
+
+// The functions from here down to the public ones expect cold_lock to be held.
+
+static Block *block_with_id(int64_t id) {
+  return id < blocks->count ? array__item_val(blocks, id, Block *) : NULL;
+}
+
+static CacheEntry *entry_for_id(int64_t id) {
+  for (int i = 0; i < cache_size; ++i) {
+    if (cache[i].id == id) return &cache[i];
+  }
+  return NULL;
+}
+
+static void empty_entry(CacheEntry *entry) {
+  free(entry->raw);
+  free(entry->starts);
+  entry->id = -1;
+}
+
+static void unlink_block(Block *block) {
+  if (block->newer) block->newer->older = block->older;
+  else              newest_block        = block->older;
+  if (block->older) block->older->newer = block->newer;
+  else              oldest_block        = block->newer;
+  packed_bytes -= block->packed_len;
+}
+
+// This puts a block whose packed bytes are in memory at the front of the list.
+static void link_block(Block *block) {
+  block->newer = NULL;
+  block->older = newest_block;
+  if (newest_block) newest_block->newer = block;
+  else              oldest_block        = block;
+  newest_block  = block;
+  packed_bytes += block->packed_len;
+}
+
+// This drops the packed bytes of the least recently decoded blocks from memory
+// until they fit the budget. Blocks that can't be written out stay in memory.
+static void enforce_budget() {
+  Block *block = oldest_block;
+  while (packed_bytes > budget && block) {
+    Block *newer = block->newer;
+    if (block->num_readers) {
+      block = newer;
+      continue;
+    }
+    if (block->file_offset == -1) {
+      if (scratch_file == NULL) scratch_file = tmpfile();
+      if (scratch_file == NULL) return;
+      ssize_t n = pwrite(fileno(scratch_file), block->packed,
+                         block->packed_len, scratch_len);
+      if (n != (ssize_t)block->packed_len) return;
+      block->file_offset = scratch_len;
+      scratch_len       += block->packed_len;
+    }
+    unlink_block(block);
+    free(block->packed);
+    block->packed = NULL;
+    block = newer;
+  }
+}
+
+static void release_refs(int64_t id, int64_t num_refs) {
+  Block *block = block_with_id(id);
+  block->num_refs -= num_refs;
+  if (block->num_refs > 0) return;
+  CacheEntry *entry = entry_for_id(id);
+  if (entry) empty_entry(entry);
+  if (block->packed) unlink_block(block);
+  free(block->packed);
+  free(block);
+  array__item_val(blocks, id, Block *) = NULL;
+}
+
+// Returns an empty or least recently used entry, emptied, or NULL if every
+// entry is being decoded.
+static CacheEntry *claim_entry() {
+  CacheEntry *oldest = NULL;
+  for (int i = 0; i < cache_size; ++i) {
+    CacheEntry *entry = &cache[i];
+    if (entry->id == -1) return entry;
+    if (entry->is_ready && (!oldest || entry->last_use < oldest->last_use)) {
+      oldest = entry;
+    }
+  }
+  if (oldest) empty_entry(oldest);
+  return oldest;
+}
+
+// This decodes block `id` into new *raw and *starts arrays, letting go of the
+// lock meanwhile. The packed bytes are read back from the scratch file if they
+// aren't in memory. The caller releases the reference this adds to the block.
+static void unpack_block(int64_t id, char **raw_ptr, uint32_t **starts_ptr) {
+  Block *block = block_with_id(id);
+  block->num_refs++;     // This keeps the block alive while we decode it.
+  block->num_readers++;  // This keeps its packed bytes in memory.
+  if (block->packed) {
+    unlink_block(block);
+    link_block(block);
+  }
+  char *packed = block->packed;
+  pthread_mutex_unlock(&cold_lock);
+
+  if (packed == NULL) {
+    packed = malloc(block->packed_len + copy_slack);
+    if (pread(fileno(scratch_file), packed, block->packed_len,
+              block->file_offset) != (ssize_t)block->packed_len) {
+      printf("%s\n", error__bad_scratch_read);
+      exit(1);
+    }
+  }
+  trace__begin("decode block");
+  char     *raw    = malloc(block->raw_len + copy_slack);
+  uint32_t *starts = malloc(block->num_lines * sizeof(uint32_t));
+  unpack(packed, block->packed_len, raw);
+  char *cursor = raw;
+  for (int k = 0; k < block->num_lines; ++k) {
+    starts[k] = (uint32_t)(cursor - raw);
+    cursor   += strlen(cursor) + 1;
+  }
+  trace__end();
+
+  pthread_mutex_lock(&cold_lock);
+  if (block->packed == NULL) {
+    block->packed = packed;
+    link_block(block);
+  } else if (block->packed != packed) {
+    free(packed);  // Another reader brought the bytes back first.
+  }
+  block->num_readers--;
+  *raw_ptr    = raw;
+  *starts_ptr = starts;
+}
+
+// This decodes block `id` into `entry`, letting go of the lock meanwhile.
+static void decode_into(CacheEntry *entry, int64_t id) {
+  entry->id       = id;
+  entry->raw      = NULL;
+  entry->starts   = NULL;
+  entry->is_ready = 0;
+  entry->was_read = 0;
+  unpack_block(id, &entry->raw, &entry->starts);
+  entry->is_ready = 1;
+  entry->last_use = ++num_uses;
+  pthread_cond_broadcast(&did_decode);
+  release_refs(id, 1);
+  enforce_budget();
+}
+
+// Decoder threads take block ids from the queue.
+static void *decode_queued_blocks(void *unused) {
+  trace__name_thread("decoder");
+  pthread_mutex_lock(&cold_lock);
+  while (1) {
+    while (num_queued == 0) pthread_cond_wait(&has_work, &cold_lock);
+    int64_t id = queue[0];
+    memmove(queue, queue + 1, --num_queued * sizeof(int64_t));
+    if (block_with_id(id) == NULL || entry_for_id(id)) continue;
+    CacheEntry *entry = claim_entry();
+    if (entry) decode_into(entry, id);
+  }
+  return NULL;
+}
+
+static int is_queued(int64_t id) {
+  for (int i = 0; i < num_queued; ++i) {
+    if (queue[i] == id) return 1;
+  }
+  return 0;
+}
+
+// This queues the next few blocks after the line at `index` for decoding. Each
+// step jumps to where the block's lines would end if they're still in order.
+static void prefetch_after(ed2__Editor *ed, int64_t index) {
+  int64_t last_id = block_id(line_id_at_index(ed, index));
+  int64_t limit   = index + prefetch_depth * 2 * cold__chunk_lines;
+  if (limit > ed->lines->count) limit = ed->lines->count;
+  for (int64_t i = index + 1; i < limit && num_queued < prefetch_depth;) {
+    char *line = line_id_at_index(ed, i);
+    if (!cold__is_cold(line)) {
+      i++;
+      continue;
+    }
+    int64_t id = block_id(line);
+    if (id != last_id && !entry_for_id(id) && !is_queued(id)) {
+      queue[num_queued++] = id;
+      pthread_cond_signal(&has_work);
+    }
+    last_id = id;
+    i += block_with_id(id)->num_lines - line_in_block(line);
+  }
+}
+
+static void init_if_needed() {
+  if (blocks) return;
+  blocks      = array__new(64, sizeof(Block *));
+  chunk_ticks = array__new(64, sizeof(uint32_t));
+  for (int i = 0; i < cache_size; ++i) cache[i].id = -1;
+
+  long num_cpus     = sysconf(_SC_NPROCESSORS_ONLN);
+  int  num_decoders = num_cpus > 1 ? (int)num_cpus - 1 : 1;
+  if (num_decoders > max_decoders) num_decoders = max_decoders;
+  for (int i = 0; i < num_decoders; ++i) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, decode_queued_blocks, NULL) == 0) {
+      pthread_detach(thread);
+    }
+  }
+}
+
+// Returns the cache entry with the decoded lines of the block `id`.
+static CacheEntry *ready_entry(int64_t id) {
+  CacheEntry *entry = entry_for_id(id);
+  if (entry == NULL) {
+    entry = claim_entry();
+    decode_into(entry, id);
+  }
+  while (!entry->is_ready) pthread_cond_wait(&did_decode, &cold_lock);
+  entry->last_use = ++num_uses;
+  return entry;
+}
+
+// Returns the cache entry with the decoded lines of the block `id`, which
+// stays in the cache until the next call from this thread.
+static CacheEntry *decoded_block(ed2__Editor *ed, int64_t id,
+                                 int64_t index) {
+  CacheEntry *entry = ready_entry(id);
+  // Blocks are only prefetched when reads seem to be going through the lines
+  // in order.
+  if (!entry->was_read) {
+    entry->was_read = 1;
+    if (index > last_first_read &&
+        index - last_first_read <= 2 * cold__chunk_lines) {
+      prefetch_after(ed, index);
+    }
+    last_first_read = index;
+  }
+  return entry;
+}
+
+// This packs the given lines, which are at the given indexes, into one block.
+static void pack_lines(ed2__Editor *ed, Array indexes, int64_t first,
+                       int64_t num_lines, size_t raw_len) {
+  trace__begin("pack block");
+  Block *block = malloc(sizeof(Block));
+  block->num_refs    = num_lines;
+  block->raw_len     = raw_len;
+  block->num_lines   = (int)num_lines;
+  block->file_offset = -1;
+  block->num_readers = 0;
+  char *raw    = malloc(raw_len);
+  char *cursor = raw;
+  for (int64_t k = 0; k < num_lines; ++k) {
+    int64_t index = array__item_val(indexes, first + k, int64_t);
+    cursor = stpcpy(cursor, line_text_at_index(ed, index)) + 1;
+  }
+  block->packed     = malloc(max_packed_len(raw_len));
+  block->packed_len = pack(raw, raw_len, block->packed);
+  block->packed     = realloc(block->packed, block->packed_len + copy_slack);
+  free(raw);
+  trace__end();
+
+  pthread_mutex_lock(&cold_lock);
+  int64_t id = blocks->count;
+  array__new_val(blocks, Block *) = block;
+  link_block(block);
+  enforce_budget();
+  pthread_mutex_unlock(&cold_lock);
+
+  for (int64_t k = 0; k < num_lines; ++k) {
+    int64_t index  = array__item_val(indexes, first + k, int64_t);
+    char *  line   = line_id_at_index(ed, index);
+    char *  handle = make_handle(id, (int)k);
+    line_id_at_index(ed, index) = handle;
+    ed2__did_relocate_line(index, line, handle);
+    ed2__free_line(line);
+  }
+}
+
+// A block is sparse once most of its lines are gone, as when they've been
+// edited. The rest are worth packing again so the block can be freed.
+static int is_sparse(char *handle) {
+  pthread_mutex_lock(&cold_lock);
+  Block *block     = block_with_id(block_id(handle));
+  int    is_sparse = block->num_refs * 2 < block->num_lines;
+  pthread_mutex_unlock(&cold_lock);
+  return is_sparse;
+}
+
+static uint32_t *tick_of_chunk(int64_t chunk) {
+  if (chunk >= chunk_ticks->count) {
+    array__add_zeroed_items(chunk_ticks, chunk + 1 - chunk_ticks->count);
+  }
+  return (uint32_t *)array__item_ptr(chunk_ticks, chunk);
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void cold__touch(ed2__Editor *ed, int64_t index) {
+  init_if_needed();
+  *tick_of_chunk(index / cold__chunk_lines) = tick;
+  char *handle = line_id_at_index(ed, index);
+  if (!cold__is_cold(handle)) return;
+  did_edit = 1;
+  char *line = ed2__share_line(ed, strdup(cold__text_at_index(ed, index)));
+  line_id_at_index(ed, index) = line;
+  ed2__did_relocate_line(index, handle, line);
+  cold__release(handle);
+}
+
+char *cold__text_at_index(ed2__Editor *ed, int64_t index) {
+  char *handle = line_id_at_index(ed, index);
+  pthread_mutex_lock(&cold_lock);
+  CacheEntry *entry = decoded_block(ed, block_id(handle), index);
+  char       *text  = entry->raw + entry->starts[line_in_block(handle)];
+  pthread_mutex_unlock(&cold_lock);
+  return text;
+}
+
+char *cold__read_text(cold__Reader *reader, char *line) {
+  int64_t id = block_id(line);
+  if (reader->id != id) {
+    cold__free_reader(reader);
+    pthread_mutex_lock(&cold_lock);
+    unpack_block(id, &reader->raw, &reader->starts);
+    release_refs(id, 1);
+    enforce_budget();
+    pthread_mutex_unlock(&cold_lock);
+    reader->id = id;
+  }
+  return reader->raw + reader->starts[line_in_block(line)];
+}
+
+void cold__free_reader(cold__Reader *reader) {
+  if (reader->id == -1) return;
+  free(reader->raw);
+  free(reader->starts);
+  reader->id = -1;
+}
+
+void cold__freeze_range(ed2__Editor *ed, int64_t start, int64_t end) {
+  init_if_needed();
+  if (end > ed->lines->count) end = ed->lines->count;
+  Array   indexes = array__new(64, sizeof(int64_t));
+  int64_t first   = 0;  // The first index in `indexes` for the next block.
+  size_t  raw_len = 0;
+  int64_t last_id = -1;  // We check each run of a block's lines only once.
+  int     is_last_sparse = 0;
+  for (int64_t index = start; index < end; ++index) {
+    char *line = line_id_at_index(ed, index);
+    if (cold__is_cold(line)) {
+      if (block_id(line) != last_id) {
+        last_id        = block_id(line);
+        is_last_sparse = is_sparse(line);
+      }
+      if (!is_last_sparse) continue;
+    }
+    size_t len = strlen(line_text_at_index(ed, index)) + 1;
+    if (len > max_block_bytes) continue;
+    if (raw_len + len > max_block_bytes ||
+        indexes->count - first == (1 << line_bits)) {
+      pack_lines(ed, indexes, first, indexes->count - first, raw_len);
+      first   = indexes->count;
+      raw_len = 0;
+    }
+    array__new_val(indexes, int64_t) = index;
+    raw_len += len;
+  }
+  if (indexes->count > first) {
+    pack_lines(ed, indexes, first, indexes->count - first, raw_len);
+  }
+  array__delete(indexes);
+}
+
+void cold__end_command(ed2__Editor *ed) {
+  if (!use_cold_storage) return;
+  init_if_needed();
+  tick++;
+  int64_t num_chunks = (ed->lines->count + cold__chunk_lines - 1) /
+                       cold__chunk_lines;
+  for (int64_t chunk = 0; chunk < num_chunks; ++chunk) {
+    uint32_t *chunk_tick = tick_of_chunk(chunk);
+    if (*chunk_tick == 0 || tick - *chunk_tick <= idle_commands) continue;
+    cold__freeze_range(ed, chunk * cold__chunk_lines,
+                       (chunk + 1) * cold__chunk_lines);
+    *chunk_tick = 0;
+  }
+  if (did_edit || ed->lines->count != last_count) num_to_sweep = num_chunks;
+  did_edit   = 0;
+  last_count = ed->lines->count;
+  for (int i = 0; i < sweep_chunks && num_to_sweep > 0; ++i, --num_to_sweep) {
+    int64_t chunk = next_sweep++ % num_chunks;
+    if (*tick_of_chunk(chunk)) continue;
+    cold__freeze_range(ed, chunk * cold__chunk_lines,
+                       (chunk + 1) * cold__chunk_lines);
+  }
+}
+
+void cold__set_budget(size_t num_bytes) {
+  budget = num_bytes;
+}
+
+void cold__retain(char *line) {
+  pthread_mutex_lock(&cold_lock);
+  block_with_id(block_id(line))->num_refs++;
+  pthread_mutex_unlock(&cold_lock);
+}
+
+void cold__release(char *line) {
+  pthread_mutex_lock(&cold_lock);
+  release_refs(block_id(line), 1);
+  pthread_mutex_unlock(&cold_lock);
+}
+
+void cold__retain_lines(Array some_lines) {
+  if (blocks == NULL) return;
+  pthread_mutex_lock(&cold_lock);
+  array__for(char **, line, some_lines, i) {
+    if (cold__is_cold(*line)) block_with_id(block_id(*line))->num_refs++;
+  }
+  pthread_mutex_unlock(&cold_lock);
+}
+
+void cold__release_lines(Array some_lines) {
+  if (blocks == NULL) return;
+  pthread_mutex_lock(&cold_lock);
+  array__for(char **, line, some_lines, i) {
+    if (cold__is_cold(*line)) release_refs(block_id(*line), 1);
+  }
+  pthread_mutex_unlock(&cold_lock);
+}
+
+void cold__did_insert_lines(int64_t index, int64_t num_lines) {
+  if (!use_cold_storage) return;
+  init_if_needed();
+  did_edit = 1;
+  int64_t last = index + num_lines - 1;
+  for (int64_t chunk = index / cold__chunk_lines;
+       chunk <= last / cold__chunk_lines; ++chunk) {
+    *tick_of_chunk(chunk) = tick;
+  }
+}
+
+void cold__add_memory_usage(memory__Usage *usage) {
+  if (blocks == NULL) return;
+  pthread_mutex_lock(&cold_lock);
+  memory__add_array(usage, blocks);
+  memory__add_array(usage, chunk_ticks);
+  array__for(Block **, block, blocks, i) {
+    if (*block == NULL) continue;
+    memory__add_block(usage, *block, sizeof(Block));
+    memory__add_block(usage, (*block)->packed, (*block)->packed_len);
+  }
+  for (int i = 0; i < cache_size; ++i) {
+    if (cache[i].id == -1 || !cache[i].is_ready) continue;
+    Block *block = block_with_id(cache[i].id);
+    if (block == NULL) continue;
+    memory__add_block(usage, cache[i].raw, block->raw_len);
+    memory__add_block(usage, cache[i].starts,
+                      block->num_lines * sizeof(uint32_t));
+  }
+  pthread_mutex_unlock(&cold_lock);
+}
@@ -0,0 +1,101 @@
+// cold.h
+//
+// Optional compressed storage for lines that haven't been used recently.
+//
+// With the -z option, the lines are kept in chunks of cold__chunk_lines
+// consecutive indexes. After each command, the lines of any chunk that the
+// last few commands didn't use are packed together into a block with a fast
+// LZ77 codec, and their items in `lines` become handles to the block. A
+// handle is a `char *` item with bit 0 set; it names one line of one block,
+// and since block ids are never reused, it names that line forever.
+//
+// The line_at_index() accessor thaws a cold line, making it a string again,
+// before giving it out. Code that only reads lines uses line_text_at_index()
+// instead, which decodes blocks into a small cache without thawing anything;
+// worker threads decode the blocks a scan is about to reach, so that long
+// scans rarely wait on the codec.
+//
+// With a memory budget, set by the -m option, the packed blocks that were
+// least recently decoded are moved out to an unlinked scratch file whenever
+// the packed blocks in memory would take more than the budget, and are read
+// back in when they're next decoded.
+//
+
+#pragma once
+
+#include "cstructs/cstructs.h"
+#include "memory.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// This is declared in ed2.h, which includes this header.
+struct ed2__Editor;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public constants and macros.
+
+#define cold__chunk_lines 4096
+
+// This is true iff `line` is a handle rather than a string.
+#define cold__is_cold(line) ((uintptr_t)(line) & 1)
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+// This holds one decoded block for cold__read_text.
+typedef struct {
+  int64_t    id;
+  char *     raw;
+  uint32_t * starts;
+} cold__Reader;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This thaws the line of `ed` at `index` if it's cold, and notes that its
+// chunk is in use.
+void   cold__touch(struct ed2__Editor *ed, int64_t index);
+
+// This returns the text of the cold line of `ed` at `index` without thawing
+// it. The text is valid until the next call.
+char * cold__text_at_index(struct ed2__Editor *ed, int64_t index);
+
+// This returns the text of the cold line `line`, decoding its block into
+// `reader` rather than the shared cache, so that it may be called from any
+// thread while `line` is retained. The text is valid until the next call with
+// the same reader. A reader starts out as { .id = -1 }.
+char * cold__read_text(cold__Reader *reader, char *line);
+void   cold__free_reader(cold__Reader *reader);
+
+// This packs the lines of `ed` in the index range [start, end) that aren't
+// already cold into new blocks, along with any cold lines from blocks whose
+// other lines are mostly gone.
+void   cold__freeze_range(struct ed2__Editor *ed, int64_t start, int64_t end);
+
+// This is called between commands; it packs chunks of `ed` that have gone
+// unused.
+void   cold__end_command(struct ed2__Editor *ed);
+
+// This limits how many bytes of packed blocks are kept in memory; the rest are
+// kept in the scratch file. There is no limit by default.
+void   cold__set_budget(size_t num_bytes);
+
+// These count copies of a handle, as in the undo backup, and release them.
+// A block is freed once no handle to it remains.
+void   cold__retain(char *line);
+void   cold__release(char *line);
+
+// These do the same for each handle in `some_lines`, an Array of lines.
+void   cold__retain_lines(Array some_lines);
+void   cold__release_lines(Array some_lines);
+
+// This notes that new lines are in use at indexes [index, index + num_lines).
+void   cold__did_insert_lines(int64_t index, int64_t num_lines);
+
+// This adds the packed blocks in memory and the decoded blocks in the cache to
+// `usage`.
+void   cold__add_memory_usage(memory__Usage *usage);
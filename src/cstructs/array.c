@@ -9,24 +9,70 @@
 #include "memprofile.h"
 #endif
 
+#include <assert.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-Array array__new(int capacity, size_t item_size) {
+// Internal functions.
+
+// Moves the gap so that it begins just before the item now at `index`.
+static void move_gap(Array array, int64_t index) {
+  int64_t gap_len = array->capacity - array->count;
+  size_t  size    = array->item_size;
+  char *  items   = array->items;
+  if (gap_len && index < array->gap_index) {
+    memmove(items + (index + gap_len) * size,   // dst
+            items + index * size,               // src
+            (array->gap_index - index) * size); // len
+  } else if (gap_len && index > array->gap_index) {
+    memmove(items + array->gap_index * size,              // dst
+            items + (array->gap_index + gap_len) * size,  // src
+            (index - array->gap_index) * size);           // len
+  }
+  array->gap_index = index;
+}
+
+// Doubles the capacity until it's at least `min_capacity`. Items after the gap
+// are moved to the new end, so the gap stays at gap_index.
+static void grow(Array array, int64_t min_capacity) {
+  if (array->capacity >= min_capacity) return;
+  int64_t old_gap_len = array->capacity - array->count;
+  while (array->capacity < min_capacity) {
+    array->capacity *= 2;
+    if (array->capacity == 0) array->capacity = 1;
+  }
+  array->items = realloc(array->items,
+                         array->capacity * array->item_size);
+  int64_t num_after_gap = array->count - array->gap_index;
+  if (num_after_gap == 0) return;
+  int64_t new_gap_len = array->capacity - array->count;
+  size_t  size        = array->item_size;
+  memmove(array->items + (array->gap_index + new_gap_len) * size,  // dst
+          array->items + (array->gap_index + old_gap_len) * size,  // src
+          num_after_gap * size);                                   // len
+}
+
+
+// Public functions.
+
+Array array__new(int64_t capacity, size_t item_size) {
   Array array = malloc(sizeof(ArrayStruct));
   return array__init(array, capacity, item_size);
 }
 
-Array array__init(Array array, int capacity, size_t item_size) {
+Array array__init(Array array, int64_t capacity, size_t item_size) {
   if (capacity < 1) capacity = 1;
   array->count = 0;
   array->capacity = capacity;
   array->item_size = item_size;
   array->releaser = NULL;
+  array->gap_index = 0;
+  array->is_gap_buffer = 0;
   if (capacity) {
-    array->items = malloc((int)item_size * capacity);
+    array->items = malloc(item_size * capacity);
   } else {
     array->items = NULL;
   }
@@ -35,11 +81,12 @@ Array array__init(Array array, int capacity, size_t item_size) {
 
 void array__clear_with_context(Array array, void *context) {
   if (array->releaser) {
-    for (int i = 0; i < array->count; ++i) {
+    for (int64_t i = 0; i < array->count; ++i) {
       array->releaser(array__item_ptr(array, i), context);
     }
   }
   array->count = 0;
+  array->gap_index = 0;
 }
 
 void array__release_with_context(void *array, void *context) {
@@ -66,7 +113,13 @@ void array__delete(Array array) {
   array__delete_with_context(array, NULL);  // NULL --> context
 }
 
-void *array__item_ptr(Array array, int index) {
+void array__set_gap_buffer(Array array, int is_gap_buffer) {
+  if (!is_gap_buffer) array__make_contiguous(array);
+  array->is_gap_buffer = is_gap_buffer;
+}
+
+void *array__item_ptr(Array array, int64_t index) {
+  if (index >= array->gap_index) index += array->capacity - array->count;
   return (void *)(array->items + index * array->item_size);
 }
 
@@ -75,74 +128,120 @@ void array__add_item_ptr(Array array, void *item) {
 }
 
 void *array__new_ptr(Array array) {
-  if (array->count == array->capacity) {
-    array->capacity *= 2;
-    if (array->capacity == 0) array->capacity = 1;
-    array->items = realloc(array->items,
-                           array->capacity * (int)array->item_size);
-  }
+  array__make_contiguous(array);
+  grow(array, array->count + 1);
   array->count++;
+  array->gap_index++;
   return array__item_ptr(array, array->count - 1);
 }
 
-void array__insert_items(Array array, int index, void *items, int num_items) {
+// Makes room for num_items new items at index and returns a pointer to them,
+// leaving their bytes for the caller to set.
+static char *open_items(Array array, int64_t index, int64_t num_items) {
+  if (array->is_gap_buffer) {
+    // The new items go at the start of the gap.
+    move_gap(array, index);
+    grow(array, array->count + num_items);
+    array->gap_index += num_items;
+    array->count     += num_items;
+    return array->items + index * array->item_size;
+  }
+
   // array starts as <prefix> <suffix>; we'll move over <suffix> so it becomes
   //                 <prefix> <new-items> <suffix>.
-  int num_new_item_bytes = num_items * array->item_size;
+  size_t num_new_item_bytes = num_items * array->item_size;
   // The order here is important. We want to use the original count first. The
   // expansion may change array->items, so we only refer to it afterwards.
-  int num_suffix_bytes = (array->count - index) * array->item_size;
-  array__add_zeroed_items(array, num_items);
+  size_t num_suffix_bytes = (array->count - index) * array->item_size;
+  array__make_contiguous(array);
+  grow(array, array->count + num_items);
+  array->count     += num_items;
+  array->gap_index += num_items;
   char *index_pt = (char *)array->items + index * array->item_size;
   memmove(index_pt + num_new_item_bytes,  // dst
           index_pt,                       // src
           num_suffix_bytes);              // len
-
-  // Copy over the new items.
-  memcpy(index_pt,             // dst
-         items,                // src
-         num_new_item_bytes);  // len
+  return index_pt;
 }
 
 void array__append_array(Array dst, Array src) {
   // We avoid using array__for since we don't know which type of pointer to use.
-  for (int i = 0; i < src->count; ++i) {
+  for (int64_t i = 0; i < src->count; ++i) {
     void *item = array__item_ptr(src, i);
     array__add_item_ptr(dst, item);
   }
 }
 
-int array__index_of(Array array, void *item) {
+int64_t array__index_of(Array array, void *item) {
   ptrdiff_t byte_dist = (char *)item - array->items;
-  return (int)(byte_dist / array->item_size);
+  int64_t index = (int64_t)(byte_dist / array->item_size);
+  if (index >= array->gap_index) index -= array->capacity - array->count;
+  return index;
 }
 
 void array__remove_item(Array array, void *item) {
   if (array->releaser) array->releaser(item, NULL);
-  int num_left = --(array->count);
+  if (array->is_gap_buffer) {
+    // Widen the gap backwards over the item.
+    move_gap(array, array__index_of(array, item) + 1);
+    array->gap_index--;
+    array->count--;
+    return;
+  }
+  array->gap_index--;
+  int64_t num_left = --(array->count);
   char *item_byte = (char *)item;
   ptrdiff_t byte_dist = item_byte - array->items;
-  int index = (int)(byte_dist / array->item_size);
+  int64_t index = (int64_t)(byte_dist / array->item_size);
   if (index == num_left) return;
   memmove(item_byte, item_byte + array->item_size,
             (num_left - index) * array->item_size);
 }
 
-void array__add_zeroed_items(Array array, int num_items) {
-  int new_count = array->count + num_items;
-  int resize_needed = 0;
-  while (array->capacity < new_count) {
-    array->capacity *= 2;
-    if (array->capacity == 0) array->capacity = 1;
-    resize_needed = 1;
+void array__insert_items(Array array, int64_t index,
+                         void *items, int64_t num_items) {
+  memcpy(open_items(array, index, num_items),  // dst
+         items,                                // src
+         num_items * array->item_size);        // len
+}
+
+void array__insert_zeroed_items(Array array, int64_t index, int64_t num_items) {
+  memset(open_items(array, index, num_items), 0, num_items * array->item_size);
+}
+
+void array__remove_items(Array array, int64_t index, int64_t num_items) {
+  assert(num_items >= 0);
+  if (array->releaser) {
+    for (int64_t i = index; i < index + num_items; ++i) {
+      array->releaser(array__item_ptr(array, i), NULL);
+    }
   }
-  if (resize_needed) {
-    array->items = realloc(array->items,
-                           array->capacity * (int)array->item_size);
+  if (array->is_gap_buffer) {
+    // Widen the gap backwards over the items.
+    move_gap(array, index + num_items);
+    array->gap_index -= num_items;
+    array->count     -= num_items;
+    return;
   }
-  void *bytes_to_zero = array__item_ptr(array, array->count);
+  char *index_pt = array->items + index * array->item_size;
+  memmove(index_pt,                                                 // dst
+          index_pt + num_items * array->item_size,                  // src
+          (array->count - index - num_items) * array->item_size);  // len
+  array->count    -= num_items;
+  array->gap_index = array->count;
+}
+
+void array__add_zeroed_items(Array array, int64_t num_items) {
+  array__make_contiguous(array);
+  grow(array, array->count + num_items);
+  void *bytes_to_zero = array->items + array->count * array->item_size;
   memset(bytes_to_zero, 0, num_items * array->item_size);
-  array->count = new_count;
+  array->count     += num_items;
+  array->gap_index += num_items;
+}
+
+void array__make_contiguous(Array array) {
+  move_gap(array, array->count);
 }
 
 static int compare_as_ints(void *item_size,
@@ -158,48 +257,197 @@ static int compare_as_ints(void *item_size,
   return 0;
 }
 
-typedef int (*CompareFn)(void *context, const void *item1, const void *item2);
+// Sorting is a merge sort that carries its comparison function and context in
+// a SortJob rather than in globals, so it's reentrant and can run in threads.
+
+// Below this many items, a run is sorted by insertion sort.
+#define insertion_sort_max 16
+
+// Below this many items per thread, we don't start more threads.
+#define min_items_per_thread 65536
+
+typedef struct {
+  char *                 items;
+  char *                 tmp;  // Scratch space with the same size as items.
+  size_t                 item_size;
+  array__CompareFunction compare;
+  void *                 context;
+} SortJob;
+
+typedef struct {
+  SortJob *job;
+  int64_t  lo;
+  int64_t  mid;  // Only used for merges.
+  int64_t  hi;
+} SortTask;
+
+#define item_at(job, i) ((job)->items + (i) * (job)->item_size)
+
+// A memcpy of a constant size compiles to a plain load and store, so common
+// item sizes get their own calls.
+static void copy_item(char *dst, char *src, size_t size) {
+  switch (size) {
+    case 4:  memcpy(dst, src,  4); break;
+    case 8:  memcpy(dst, src,  8); break;
+    case 16: memcpy(dst, src, 16); break;
+    case 24: memcpy(dst, src, 24); break;
+    default: memcpy(dst, src, size);
+  }
+}
+
+// Sorts the items with indexes in [lo, hi). This uses the item at tmp + lo as
+// scratch space.
+static void insertion_sort(SortJob *job, int64_t lo, int64_t hi) {
+  size_t size = job->item_size;
+  char * held = job->tmp + lo * size;
+  for (int64_t i = lo + 1; i < hi; ++i) {
+    int64_t j = i;
+    while (j > lo && job->compare(job->context,
+                                  item_at(job, j - 1), item_at(job, i)) > 0) {
+      --j;
+    }
+    if (j == i) continue;
+    copy_item(held, item_at(job, i), size);
+    memmove(item_at(job, j + 1), item_at(job, j), (i - j) * size);
+    copy_item(item_at(job, j), held, size);
+  }
+}
+
+// Merges the sorted runs [lo, mid) and [mid, hi). Ties go to the left run,
+// which keeps the sort stable.
+static void merge(SortJob *job, int64_t lo, int64_t mid, int64_t hi) {
+  size_t  size = job->item_size;
+  int64_t i    = lo;
+  int64_t j    = mid;
+  char *  out  = job->tmp + lo * size;
+  while (i < mid && j < hi) {
+    int64_t *src = (job->compare(job->context,
+                                 item_at(job, i), item_at(job, j)) <= 0 ?
+                    &i : &j);
+    copy_item(out, item_at(job, *src), size);
+    out += size;
+    (*src)++;
+  }
+  // Whatever is left in [j, hi) is already in place.
+  memcpy(out, item_at(job, i), (mid - i) * size);
+  memcpy(item_at(job, lo), job->tmp + lo * size, (j - lo) * size);
+}
 
-static CompareFn user_compare;
-static void *user_context;
+static void merge_sort(SortJob *job, int64_t lo, int64_t hi) {
+  if (hi - lo <= insertion_sort_max) {
+    insertion_sort(job, lo, hi);
+    return;
+  }
+  int64_t mid = lo + (hi - lo) / 2;
+  merge_sort(job, lo, mid);
+  merge_sort(job, mid, hi);
+  // Skip the merge when the two runs are already in order.
+  void *last_left = item_at(job, mid - 1);
+  if (job->compare(job->context, last_left, item_at(job, mid)) > 0) {
+    merge(job, lo, mid, hi);
+  }
+}
 
-static int custom_compare(const void *item1, const void *item2) {
-  return user_compare(user_context, item1, item2);
+static void *run_sort_task(void *task_vp) {
+  SortTask *task = (SortTask *)task_vp;
+  merge_sort(task->job, task->lo, task->hi);
+  return NULL;
+}
+
+static void *run_merge_task(void *task_vp) {
+  SortTask *task = (SortTask *)task_vp;
+  merge(task->job, task->lo, task->mid, task->hi);
+  return NULL;
+}
+
+// Runs fn on each task, using a thread for every task but the last one.
+static void run_tasks(void *(*fn)(void *), SortTask *tasks, int num_tasks) {
+  pthread_t *threads = malloc(num_tasks * sizeof(pthread_t));
+  int *is_started = calloc(num_tasks, sizeof(int));
+  for (int i = 0; i < num_tasks - 1; ++i) {
+    is_started[i] = (pthread_create(&threads[i], NULL, fn, &tasks[i]) == 0);
+    if (!is_started[i]) fn(&tasks[i]);  // Fall back to this thread.
+  }
+  fn(&tasks[num_tasks - 1]);
+  for (int i = 0; i < num_tasks - 1; ++i) {
+    if (is_started[i]) pthread_join(threads[i], NULL);
+  }
+  free(is_started);
+  free(threads);
 }
 
 void array__sort(Array array,
                  array__CompareFunction compare,
                  void *compare_context) {
-  CompareFn old_compare = user_compare;
-  void *old_context = user_context;
+  array__parallel_sort(array, compare, compare_context, 1);
+}
 
-  if (compare == NULL) {
-    user_compare = compare_as_ints;
-    user_context = &(array->item_size);
-  } else {
-    user_compare = compare;
-    user_context = compare_context;
+void array__parallel_sort(Array array,
+                          array__CompareFunction compare,
+                          void *compare_context,
+                          int num_threads) {
+  if (array->count < 2) return;
+  array__make_contiguous(array);
+
+  SortJob job = {
+    .items     = array->items,
+    .tmp       = malloc(array->count * array->item_size),
+    .item_size = array->item_size,
+    .compare   = compare ? compare : compare_as_ints,
+    .context   = compare ? compare_context : &array->item_size
+  };
+
+  int64_t max_threads = array->count / min_items_per_thread;
+  if (num_threads > max_threads) num_threads = (int)max_threads;
+  if (num_threads < 2) {
+    merge_sort(&job, 0, array->count);
+    free(job.tmp);
+    return;
   }
-  qsort(array->items, array->count, array->item_size, custom_compare);
 
-  user_compare = old_compare;
-  user_context = old_context;
-}
+  // 1. Sort num_threads runs of about equal size in parallel.
+  // bounds[i] is where run i starts; bounds[num_runs] is the end.
+  int64_t *bounds = malloc((num_threads + 1) * sizeof(int64_t));
+  SortTask *tasks = malloc(num_threads * sizeof(SortTask));
+  for (int i = 0; i <= num_threads; ++i) {
+    bounds[i] = array->count * i / num_threads;
+  }
+  for (int i = 0; i < num_threads; ++i) {
+    tasks[i] = (SortTask){ &job, bounds[i], 0, bounds[i + 1] };
+  }
+  run_tasks(run_sort_task, tasks, num_threads);
 
-static size_t item_size;
+  // 2. Merge neighboring runs in parallel until one run is left.
+  for (int num_runs = num_threads; num_runs > 1;) {
+    int num_merges = num_runs / 2;
+    for (int i = 0; i < num_merges; ++i) {
+      tasks[i] = (SortTask){ &job, bounds[2 * i], bounds[2 * i + 1],
+                             bounds[2 * i + 2] };
+    }
+    run_tasks(run_merge_task, tasks, num_merges);
+    // Drop the boundaries between merged runs; an odd last run stays as is.
+    int new_num_runs = 0;
+    for (int i = 0; i <= num_runs; i += 2) bounds[new_num_runs++] = bounds[i];
+    if (num_runs % 2) bounds[new_num_runs++] = bounds[num_runs];
+    num_runs = new_num_runs - 1;
+  }
 
-static int compare_for_find(const void *a, const void *b) {
-  return memcmp(a, b, item_size);
+  free(tasks);
+  free(bounds);
+  free(job.tmp);
 }
 
 void *array__find(Array array, void *item) {
-  size_t old_size = item_size;
-  item_size = array->item_size;
-  void *found_val = bsearch(item,               // key
-                            array->items,       // data base ptr
-                            array->count,       // num items
-                            array->item_size,   // item width
-                            compare_for_find);  // cmp function
-  item_size = old_size;
-  return found_val;
+  array__make_contiguous(array);
+  int64_t lo = 0;
+  int64_t hi = array->count;
+  while (lo < hi) {
+    int64_t mid = lo + (hi - lo) / 2;
+    void *mid_item = array->items + mid * array->item_size;
+    int cmp = compare_as_ints(&array->item_size, mid_item, item);
+    if (cmp == 0) return mid_item;
+    if (cmp < 0) lo = mid + 1;
+    else         hi = mid;
+  }
+  return NULL;
 }
@@ -10,16 +10,27 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef void (*Releaser)(void *item, void *context);
 
+// Counts and indexes are 64-bit so that an array may hold more than 2^31 items
+// or more than 2 GB of item bytes.
+//
+// The unused capacity is a gap that begins just before the item at gap_index.
+// Normally the gap stays at the end, so gap_index == count and items are
+// contiguous. In gap-buffer mode, the gap is left wherever the last insertion
+// or removal happened, so further edits nearby only move the items between
+// the old and new edit positions.
 typedef struct {
-  int      count;
-  int      capacity;
+  int64_t  count;
+  int64_t  capacity;
   size_t   item_size;
   Releaser releaser;
   char *   items;
+  int64_t  gap_index;
+  int      is_gap_buffer;
 } ArrayStruct;
 
 typedef ArrayStruct *Array;
@@ -28,10 +39,14 @@ typedef ArrayStruct *Array;
 // Constant-time operations.
 
 // Allocates and initializes a new array.
-Array array__new  (int capacity, size_t item_size);
+Array array__new  (int64_t capacity, size_t item_size);
 
 // For use on an allocated but uninitialized array struct.
-Array array__init (Array array, int capacity, size_t item_size);
+Array array__init (Array array, int64_t capacity, size_t item_size);
+
+// Turns gap-buffer mode on or off. Turning it off moves the gap to the end, a
+// linear-time operation.
+void  array__set_gap_buffer (Array array, int is_gap_buffer);
 
 
 // The next three methods are O(1) if there's no releaser; O(n) if there is.
@@ -44,7 +59,9 @@ void array__clear_with_context   (Array array, void *context);
 void array__release_with_context (void *array, void *context);
 void array__delete_with_context  (Array array, void *context);
 
-void *  array__item_ptr(Array array, int index);
+// In gap-buffer mode, the items after the gap are at a fixed offset, so this
+// remains constant-time.
+void *  array__item_ptr(Array array, int64_t index);
 #define array__item_val(array, i, type) (*(type *)array__item_ptr(array, i))
 
 // Amortized constant-time operations (usually constant-time, sometimes linear).
@@ -55,15 +72,25 @@ void *  array__new_ptr(Array array);
 #define array__new_val(a, type) (*(type *)array__new_ptr(a))
 
 // Possibly linear time operations.
+// In gap-buffer mode, inserting or removing items costs time proportional to
+// the distance from the previous insertion or removal, not to the count.
 
-void array__insert_items (Array array, int index, void *items, int num_items);
-void array__append_array (Array dst, Array src);  // Expects dst != src.
-int  array__index_of     (Array array, void *item);
+void    array__insert_items (Array array, int64_t index,
+                             void *items, int64_t num_items);
+void    array__insert_zeroed_items(Array array, int64_t index,
+                                   int64_t num_items);
+void    array__append_array (Array dst, Array src);  // Expects dst != src.
+int64_t array__index_of     (Array array, void *item);
 
 // The item is expected to be an object already within the array, i.e.,
 // the location of item should be in the array->items memory buffer.
 void array__remove_item      (Array array, void *item);
-void array__add_zeroed_items (Array array, int num_items);
+void array__remove_items     (Array array, int64_t index, int64_t num_items);
+void array__add_zeroed_items (Array array, int64_t num_items);
+
+// Moves any gap to the end so that array->items holds all items in order. The
+// sort and find functions do this for you.
+void array__make_contiguous  (Array array);
 
 // Loop over an array.
 // Example: array__for(item_type *, item_ptr, array, index) { /* loop body */ }
@@ -75,18 +102,30 @@ void array__add_zeroed_items (Array array, int num_items);
 // *any* additions at all - may invalidate item_ptr until the start of the next
 // iteration.
 #define array__for(type, item_ptr, array, index)            \
-  for (int index = 0, __tmpvar = 1; __tmpvar--;)            \
+  for (int64_t index = 0, __tmpvar = 1; __tmpvar--;)        \
   for (type item_ptr = (type)array__item_ptr(array, index); \
        index < array->count;                                \
        item_ptr = (type)array__item_ptr(array, ++index))
 // The (type) cast in array__for is required by C++.
 
+// The compare function receives compare_context and pointers to two items. A
+// NULL compare function sorts in ascending memcmp order.
 typedef int (*array__CompareFunction)(void *, const void *, const void *);
 
+// This is a stable merge sort. It keeps no global state, so it's safe to sort
+// different arrays from different threads at the same time.
 void array__sort(Array array,
                  array__CompareFunction compare,
                  void *compare_context);
 
+// This is array__sort using up to num_threads threads; large arrays are split
+// into runs that are sorted and then merged in parallel. The compare function
+// may be called from several threads at once.
+void array__parallel_sort(Array array,
+                          array__CompareFunction compare,
+                          void *compare_context,
+                          int num_threads);
+
 // Assumes the array is sorted in ascending memcmp order; does a memcmp of
 // each item in the array, using a binary search.
 void *array__find(Array array, void *item);
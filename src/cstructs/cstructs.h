@@ -2,7 +2,8 @@
 //
 // https://github.com/tylerneylon/cstructs
 //
-// Overall header for including Array, List, and Map.
+// Overall header for including Array, List, and Map, along with the typed
+// Array accessors.
 // Friendly for linking with C++ sources.
 //
 
@@ -15,6 +16,7 @@ extern "C" {
 #include "array.h"
 #include "list.h"
 #include "map.h"
+#include "typed_array.h"
   
 #ifdef __cplusplus
 }
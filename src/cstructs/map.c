@@ -3,39 +3,49 @@
 // https://github.com/tylerneylon/cstructs
 //
 // Internal structure:
-// An array of buckets of size s = 2^n, where n grows to keep
-// the average load below 8.
-// We look up x by finding i = hash(x), then checking buckets
-// [i % s, i % (s/2), i % (s/4), ... ] down to % MIN_BUCKETS.
-// If avg load is > 8 just after an addition, we double the
-// number of buckets.
+// An open-addressing table of s = 2^n slots, each holding a key/value pair
+// inline along with its hash and its probe distance. Collisions are resolved
+// with Robin Hood linear probing: on insert, an entry that is closer to its
+// home slot than the one being placed gives up its slot, so probe lengths stay
+// short and uniform. A lookup can stop as soon as it sees a slot whose entry is
+// closer to home than the needle would be at that point.
+// Removal uses backward shifting, so there are no tombstones.
+// If the load would exceed MAX_LOAD just after an addition, we double the
+// number of slots.
 //
 
 #include "map.h"
 
+#include "typed_array.h"
+
 #ifdef DEBUG
 #include "memprofile.h"
 #endif
 
-#include "list.h"
+#define MIN_SLOTS 16
+#define MAX_LOAD 0.8
+
+// A slot is empty iff its dist is 0; otherwise dist - 1 is the number of steps
+// between the slot and the home slot of its hash.
+typedef struct {
+  map__key_value pair;  // This is first so a slot pointer is a pair pointer.
+  unsigned int   hash;
+  int            dist;
+} Slot;
 
-#define MIN_BUCKETS 16
-#define MAX_LOAD 2.5
+// This declares slot_array__item_ptr().
+array__declare_typed(slot_array, Slot)
 
 
 // Internal function declarations.
 // ===============================
 
-List *find_with_hash(Map map, void *needle, int h);
-List *bucket_find(List *bucket, void *needle, map__Eq eq);
-void double_size(Map map);
-void release_and_free_pair(Map map, map__key_value *pair);
-
-// This will be called from the array module.
-void release_bucket(void *bucket, void *map);
-
-// This will be called from the list module.
-void release_key_value_pair(void *pair, void *map);
+static unsigned int mixed_hash(Map map, void *key);
+static int64_t home_index(Map map, unsigned int h);
+static Slot *find_slot(Map map, void *needle, unsigned int h);
+static Slot *place_slot(Map map, Slot slot);
+static void double_size(Map map);
+static void release_pair(Map map, map__key_value *pair);
 
 
 // Public functions.
@@ -45,29 +55,27 @@ Map map__new(map__Hash hash, map__Eq eq) {
   Map map = malloc(sizeof(MapStruct));
   map->count = 0;
 
-  map->buckets = array__new(MIN_BUCKETS, sizeof(void *));
-  map->buckets->releaser = release_bucket;
-  array__add_zeroed_items(map->buckets, MIN_BUCKETS);
+  map->slots = array__new(MIN_SLOTS, sizeof(Slot));
+  array__add_zeroed_items(map->slots, MIN_SLOTS);
 
   map->hash = hash;
   map->eq = eq;
   map->key_releaser = NULL;
   map->value_releaser = NULL;
-  map->pair_alloc = malloc;
   return map;
 }
 
 void map__delete(Map map) {
-  array__delete_with_context(map->buckets, map);
+  map__clear(map);
+  array__delete(map->slots);
   free(map);
 }
 
 map__key_value *map__set(Map map, void *key, void *value) {
-  int h = map->hash(key);
-  List *entry = find_with_hash(map, key, h);
-  map__key_value *pair;
-  if (entry) {
-    pair = (*entry)->item;
+  unsigned int h = mixed_hash(map, key);
+  Slot *slot = find_slot(map, key, h);
+  if (slot) {
+    map__key_value *pair = &slot->pair;
     if (map->key_releaser && pair->key != key) {
       map->key_releaser(pair->key, NULL);
     }
@@ -77,123 +85,128 @@ map__key_value *map__set(Map map, void *key, void *value) {
     }
     pair->value = value;
     return pair;
-  } else {
-    // New pair.
-    pair = map->pair_alloc(sizeof(map__key_value));
-    pair->key = key;
-    pair->value = value;
+  }
 
-    double load = (map->count + 1) / (map->buckets->count);
-    if (load > MAX_LOAD) double_size(map);
+  // New pair.
+  double load = (double)(map->count + 1) / map->slots->count;
+  if (load > MAX_LOAD) double_size(map);
 
-    int n = map->buckets->count;
-    int index = ((unsigned int)h) % n;
-    List *bucket = (List *)array__item_ptr(map->buckets, index);
-    list__insert(bucket, pair);
-    map->count++;
-  }
-  return pair;
+  Slot new_slot = { .pair = { key, value }, .hash = h, .dist = 1 };
+  map->count++;
+  return &place_slot(map, new_slot)->pair;
 }
 
 void map__unset(Map map, void *key) {
-  int h = map->hash(key);
-  List *entry = find_with_hash(map, key, h);
-  if (entry == NULL) return;
-  release_and_free_pair(map, (*entry)->item);
-  list__remove_first(entry);
+  Slot *slot = find_slot(map, key, mixed_hash(map, key));
+  if (slot == NULL) return;
+  release_pair(map, &slot->pair);
+
+  // Shift later entries of the same probe run back by one slot.
+  int64_t mask  = map->slots->count - 1;
+  int64_t index = array__index_of(map->slots, slot);
+  while (1) {
+    int64_t next_index = (index + 1) & mask;
+    Slot *  next       = slot_array__item_ptr(map->slots, next_index);
+    if (next->dist <= 1) break;
+    *slot = *next;
+    slot->dist--;
+    slot  = next;
+    index = next_index;
+  }
+  slot->dist = 0;
   map->count--;
 }
 
 map__key_value *map__get(Map map, void *needle) {
-  List *entry = find_with_hash(map, needle, map->hash(needle));
-  return entry ? (*entry)->item : NULL;
+  Slot *slot = find_slot(map, needle, mixed_hash(map, needle));
+  return slot ? &slot->pair : NULL;
 }
 
 void map__clear(Map map) {
-  array__for(void **, elt_ptr, map->buckets, index) {
-    List *list_ptr = (List *)elt_ptr;
-    list__delete_and_release(list_ptr, release_key_value_pair, map);
+  array__typed_for(slot_array, slot, map->slots, i) {
+    if (slot->dist == 0) continue;
+    release_pair(map, &slot->pair);
+    slot->dist = 0;
   }
   map->count = 0;
 }
 
-map__key_value *map__next(Map map, int *i, void **p) {
-  // *i is the bucket index.
-  // *p is the List entry in that bucket.
-  List entry = (List)(*p);
-  while (entry == NULL && *i < (map->buckets->count - 1)) {
-    (*i)++;
-    entry = *(List *)array__item_ptr(map->buckets, *i);
-  }
-  if (entry == NULL && *i == (map->buckets->count - 1)) {
-    *p = (void *)(1);  // A token non-NULL pointer to end the outer loops.
-    return NULL;
+map__key_value *map__next(Map map, int64_t *i, void **p) {
+  // *i is the slot index of the last returned pair, starting at -1.
+  // *p is only used to end the outer loops of map__for.
+  while (++(*i) < map->slots->count) {
+    Slot *slot = slot_array__item_ptr(map->slots, *i);
+    if (slot->dist) return &slot->pair;
   }
-  void *item = entry->item;
-  *p = (void *)entry->next;
-  return item;
+  *p = (void *)(1);  // A token non-NULL pointer to end the outer loops.
+  return NULL;
 }
 
 // private functions
 // =================
 
-List *find_with_hash(Map map, void *needle, int h) {
-  int n = map->buckets->count;
-  int index = ((unsigned int)h) % n;
-  List *bucket = (List *)array__item_ptr(map->buckets, index);
-  return bucket_find(bucket, needle, map->eq);
+// Pointer-valued keys often have hashes whose low bits are all zero, and we
+// index by the low bits, so we scramble the user's hash first.
+static unsigned int mixed_hash(Map map, void *key) {
+  unsigned int h = (unsigned int)map->hash(key);
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
 }
 
-typedef struct {
-  void *needle;
-  map__Eq eq;
-} needle_info;
-
-int pair_matches_needle_info(void *p, void *i) {
-  map__key_value *pair = (map__key_value *)p;
-  needle_info *info = (needle_info *)i;
-  return info->eq(pair->key, info->needle);
+static int64_t home_index(Map map, unsigned int h) {
+  return (int64_t)(h & (uint64_t)(map->slots->count - 1));
 }
 
-List *bucket_find(List *bucket, void *needle, map__Eq eq) {
-  needle_info info;
-  info.needle = needle;
-  info.eq = eq;
-  return list__find_entry(bucket, &info, pair_matches_needle_info);
+static Slot *find_slot(Map map, void *needle, unsigned int h) {
+  int64_t mask  = map->slots->count - 1;
+  int64_t index = home_index(map, h);
+  for (int dist = 1;; ++dist, index = (index + 1) & mask) {
+    Slot *slot = slot_array__item_ptr(map->slots, index);
+    // A poorer entry would have taken this slot from any entry nearer home.
+    if (slot->dist < dist) return NULL;
+    if (slot->hash == h && map->eq(slot->pair.key, needle)) return slot;
+  }
 }
 
-void double_size(Map map) {
-  array__add_zeroed_items(map->buckets, map->buckets->count);
-  int n = map->buckets->count;
-  array__for(List *, bucket, map->buckets, index) {
-    List *entry = bucket;
-    while (*entry) {
-      map__key_value *pair = (*entry)->item;
-      unsigned int h = map->hash(pair->key);
-      int bucket_index = h % n;
-      if (bucket_index == index) {
-        entry = &((*entry)->next);
-        continue;
-      }
-      list__remove_first(entry);
-      List *new_bucket = (List *)array__item_ptr(map->buckets, bucket_index);
-      list__insert(new_bucket, pair);
+// Expects that slot.dist == 1, that slot's key is not yet in the map, and that
+// the map has at least one empty slot. Returns where the given slot ends up;
+// entries displaced along the way are carried forward to later slots.
+static Slot *place_slot(Map map, Slot slot) {
+  Slot *placed = NULL;
+  int64_t mask  = map->slots->count - 1;
+  int64_t index = home_index(map, slot.hash);
+  for (;; ++slot.dist, index = (index + 1) & mask) {
+    Slot *resident = slot_array__item_ptr(map->slots, index);
+    if (resident->dist == 0) {
+      *resident = slot;
+      return placed ? placed : resident;
+    }
+    if (resident->dist < slot.dist) {
+      Slot swap = *resident;
+      *resident = slot;
+      slot      = swap;
+      if (placed == NULL) placed = resident;
     }
-    // The last half of the list is all new; no need to look at it.
-    if (index >= n / 2) break;
   }
 }
 
-void release_and_free_pair(Map map, map__key_value *pair) {
-  if (map->key_releaser)   map->key_releaser  (pair->key,   NULL);
-  if (map->value_releaser) map->value_releaser(pair->value, NULL);
-  free(pair);
-}
-
-void release_key_value_pair(void *pair, void *map) {
-  release_and_free_pair((Map)map, (map__key_value *)pair);
+static void double_size(Map map) {
+  Array old_slots = map->slots;
+  map->slots = array__new(old_slots->count * 2, sizeof(Slot));
+  array__add_zeroed_items(map->slots, old_slots->count * 2);
+  array__typed_for(slot_array, slot, old_slots, i) {
+    if (slot->dist == 0) continue;
+    slot->dist = 1;
+    place_slot(map, *slot);
+  }
+  array__delete(old_slots);
 }
 
-void release_bucket(void *bucket, void *map) {
-  list__delete_and_release((List *)bucket, release_key_value_pair, map);
+static void release_pair(Map map, map__key_value *pair) {
+  if (map->key_releaser)   map->key_releaser  (pair->key,   NULL);
+  if (map->value_releaser) map->value_releaser(pair->value, NULL);
 }
@@ -5,6 +5,10 @@
 // C-based hash map.
 // Lookups are fast, sizing grows as needed.
 //
+// Pairs are stored inline in an open-addressing table, so the map__key_value
+// pointers returned by map__set, map__get, and map__next are only valid until
+// the next call to map__set or map__unset.
+//
 
 #pragma once
 
@@ -14,16 +18,14 @@
 
 typedef int    ( *map__Hash  )(void *);
 typedef int    ( *map__Eq    )(void *, void*);
-typedef void * ( *map__Alloc )(size_t);
 
 typedef struct {
-  int        count;
-  Array      buckets;
+  int64_t    count;
+  Array      slots;
   map__Hash  hash;
   map__Eq    eq;
   Releaser   key_releaser;
   Releaser   value_releaser;
-  map__Alloc pair_alloc;  // Default=malloc; customize to add fields per item.
 } MapStruct;
 
 typedef MapStruct *Map;
@@ -44,11 +46,11 @@ map__key_value * map__get    (Map map, void *needle);
 void             map__clear  (Map map);
 
 // This is for use with map__for.
-map__key_value * map__next   (Map map, int *i, void **p);
+map__key_value * map__next   (Map map, int64_t *i, void **p);
 
 // The variable var has type map__key_value *.
 #define map__for(var, map) \
-  for (int    __tmp_i = -1  ; __tmp_i == -1  ;) \
+  for (int64_t __tmp_i = -1 ; __tmp_i == -1  ;) \
   for (void * __tmp_p = NULL; __tmp_p == NULL;) \
   for (map__key_value *var = map__next(map, &__tmp_i, &__tmp_p); \
        var; var = map__next(map, &__tmp_i, &__tmp_p))
@@ -2,125 +2,243 @@
 //
 // https://github.com/tylerneylon/cstructs
 //
+// Internal structure:
+// Call sites live in a fixed table of up to maxSites entries, found by an
+// open-addressing index keyed on file and line, so two sites never share a
+// row. Live blocks are kept in a second open-addressing table, keyed on
+// address, holding each block's size and site; it doubles when half full and
+// uses backward shifting on removal. A single mutex guards both tables; the
+// system calls themselves are made outside it.
+//
 
 #include "memprofile.h"
 
 #undef malloc
+#undef calloc
 #undef realloc
 #undef free
+#undef strdup
+#undef strndup
 
-// Include the system-specific malloc include, and
-// redirect malloc_size to the system-specific version.
-#ifdef _WIN32
-#include <malloc.h>
-#define malloc_size _msize
-#else
-#ifdef __APPLE__
-#include <malloc/malloc.h>
-#else
-#include <malloc.h>
-#define malloc_size malloc_usable_size 
-#endif
-#endif
-
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
 
 
-// Enable strncpy on windows.
-#ifdef _WIN32
-#define strncpy(dst, src, num) strncpy_s(dst, num, src, _TRUNCATE)
-#endif
+#define maxSites 4096
+
+typedef struct {
+  const char *file;
+  int         line;
+  int64_t     numAllocs;
+  int64_t     numFrees;
+  int64_t     totalBytes;
+  int64_t     liveBytes;
+  int64_t     peakBytes;
+} Site;
+
+typedef struct {
+  void * ptr;  // This is NULL for an empty slot.
+  size_t size;
+  int    site;
+} Block;
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Site 0 collects the calls from any sites past the first maxSites - 1.
+static Site sites[maxSites] = { { "(other sites)", 0 } };
+static int  numSites = 1;
+static int  siteSlots[2 * maxSites];  // These are site indexes; 0 = empty.
 
+static Block * blocks;
+static int64_t numBlockSlots;  // This is 0 or a power of 2.
+static int64_t numBlocks;
 
-#define tableSize 500
+static int64_t liveBytes;
+static int64_t peakBytes;
+static int64_t numUntrackedFrees;  // These are frees of unknown blocks.
 
-static int byteDelta[tableSize];
-static char rowFile[tableSize][512];
-static int rowLine[tableSize];
-static int isZeroed = 0;
 
+// Internal functions.
 
-int rowNum(char *file, int line) {
-  char *c = file;
-  unsigned int val = 0;
-  while (*c++) {
-    val *= 123;
-    val += *c;
+static int findSite(const char *file, int line) {
+  uint64_t h = 14695981039346656037ull;
+  for (const char *c = file; *c; ++c) {
+    h = (h ^ (unsigned char)*c) * 1099511628211ull;
   }
-  val *= 93;
-  val += line;
-  return val % tableSize;
+  h = (h ^ (uint64_t)line) * 1099511628211ull;
+  for (uint64_t i = h % (2 * maxSites);; i = (i + 1) % (2 * maxSites)) {
+    int site = siteSlots[i];
+    if (site == 0) break;
+    if (sites[site].line == line &&
+        (sites[site].file == file || strcmp(sites[site].file, file) == 0)) {
+      return site;
+    }
+  }
+  if (numSites == maxSites) return 0;
+  sites[numSites].file = file;
+  sites[numSites].line = line;
+  for (uint64_t i = h % (2 * maxSites);; i = (i + 1) % (2 * maxSites)) {
+    if (siteSlots[i] == 0) {
+      siteSlots[i] = numSites;
+      break;
+    }
+  }
+  return numSites++;
+}
+
+static uint64_t homeSlot(void *ptr) {
+  return ((uintptr_t)ptr >> 4) * 11400714819323198485ull & (numBlockSlots - 1);
 }
 
-void *memop(char *file, int line, void *ptr, int numBytes, int isRealloc) {
-  if (!isZeroed) {
-    for (int i = 0; i < tableSize; ++i) byteDelta[i] = 0;
-    isZeroed = 1;
+// This returns the slot holding `ptr`, or the empty slot where it would go.
+static int64_t findBlock(void *ptr) {
+  uint64_t i = homeSlot(ptr);
+  while (blocks[i].ptr && blocks[i].ptr != ptr) {
+    i = (i + 1) & (numBlockSlots - 1);
   }
-  int row = rowNum(file, line);
-  strncpy(rowFile[row], file, 511);
-  rowFile[row][511] = '\0';
-  rowLine[row] = line;
-  if (isRealloc) {
-    int prevSize = (int)malloc_size(ptr);
-    void *vp = realloc(ptr, numBytes);
-    byteDelta[row] += (malloc_size(vp) - prevSize);
-    return vp;
+  return i;
+}
+
+static void noteFree(Block *block) {
+  Site *site = &sites[block->site];
+  site->numFrees  += 1;
+  site->liveBytes -= block->size;
+  liveBytes       -= block->size;
+}
+
+// This removes `ptr` from the live blocks, noting its free.
+static void removeBlock(void *ptr) {
+  if (numBlockSlots == 0 || ptr == NULL) return;
+  int64_t i = findBlock(ptr);
+  if (blocks[i].ptr == NULL) {
+    numUntrackedFrees++;
+    return;
   }
-  if (numBytes >= 0) {
-    void *vp = malloc(numBytes);
-    byteDelta[row] += malloc_size(vp);
-    return vp;
-  } else {
-    byteDelta[row] -= malloc_size(ptr);
-    free(ptr);
-    return NULL;
+  noteFree(&blocks[i]);
+  // Shift later blocks of the same run back until one is at home.
+  for (int64_t j = (i + 1) & (numBlockSlots - 1); blocks[j].ptr;
+       j = (j + 1) & (numBlockSlots - 1)) {
+    int64_t home = homeSlot(blocks[j].ptr);
+    // Block j can move to slot i iff its home isn't in (i, j], cyclically.
+    if (((j - home) & (numBlockSlots - 1)) >= ((j - i) & (numBlockSlots - 1))) {
+      blocks[i] = blocks[j];
+      i = j;
+    }
   }
+  blocks[i].ptr = NULL;
+  numBlocks--;
 }
 
-void printmeminfo() {
-  int totalDelta = 0;
-
-  int fileNet[128];
-  char files[128][512];
-  int numFiles = 0;
-
-  for (int i = 0; i < tableSize; ++i) {
-    if (byteDelta[i] != 0) {
-      totalDelta += byteDelta[i];
-      printf("%26s:%5d: %10d\n", rowFile[i], rowLine[i], byteDelta[i]);
-
-      int fileIndex = -1;
-      for (int j = 0; j < numFiles; ++j) {
-        if (strcmp(files[j], rowFile[i]) == 0) {
-          fileIndex = j;
-          break;
-        }
-      }
-      if (fileIndex == -1) {
-        fileIndex = numFiles++;
-        strncpy(files[fileIndex], rowFile[i], 511);
-        files[fileIndex][511] = '\0';
-        fileNet[fileIndex] = 0;
-      }
-      fileNet[fileIndex] += byteDelta[i];
-    }
+static void growBlocks() {
+  Block * oldBlocks   = blocks;
+  int64_t oldNumSlots = numBlockSlots;
+  numBlockSlots = oldNumSlots ? 2 * oldNumSlots : 1024;
+  blocks        = calloc(numBlockSlots, sizeof(Block));
+  for (int64_t i = 0; i < oldNumSlots; ++i) {
+    if (oldBlocks[i].ptr) blocks[findBlock(oldBlocks[i].ptr)] = oldBlocks[i];
   }
-  printf("%32s: %10d\n", "total", totalDelta);
-  printf("\nPer file net:\n");
-  for (int i = 0; i < numFiles; ++i) {
-    printf("%32s: %10d\n", files[i], fileNet[i]);
+  free(oldBlocks);
+}
+
+static void addBlock(void *ptr, size_t size, int siteIndex) {
+  if (2 * (numBlocks + 1) > numBlockSlots) growBlocks();
+  int64_t i = findBlock(ptr);
+  if (blocks[i].ptr) {
+    // The block was freed without memop; it's stale.
+    noteFree(&blocks[i]);
+  } else {
+    numBlocks++;
   }
+  blocks[i] = (Block){ .ptr = ptr, .size = size, .site = siteIndex };
+  Site *site = &sites[siteIndex];
+  site->numAllocs  += 1;
+  site->totalBytes += size;
+  site->liveBytes  += size;
+  if (site->liveBytes > site->peakBytes) site->peakBytes = site->liveBytes;
+  liveBytes += size;
+  if (liveBytes > peakBytes) peakBytes = liveBytes;
+}
 
-#ifndef __APPLE__
-#ifndef _WIN32
-  // malloc_stats doesn't exist in mac os x or windows.
-  printf("malloc_stats:\n");
-  malloc_stats();
-#endif
-#endif
+static void addBlockAt(const char *file, int line, void *ptr, size_t size) {
+  if (ptr == NULL) return;
+  pthread_mutex_lock(&mutex);
+  addBlock(ptr, size, findSite(file, line));
+  pthread_mutex_unlock(&mutex);
+}
 
+// This removes the block at `ptr` before the system frees it, so that another
+// thread can't be given the same address and add it while it's still listed.
+static void removeBlockLocked(void *ptr) {
+  pthread_mutex_lock(&mutex);
+  removeBlock(ptr);
+  pthread_mutex_unlock(&mutex);
 }
 
+static int compareByPeak(const void *a, const void *b) {
+  int64_t peakA = ((const Site *)a)->peakBytes;
+  int64_t peakB = ((const Site *)b)->peakBytes;
+  return (peakA < peakB) - (peakA > peakB);
+}
+
+
+// Public functions.
+
+void *memop(const char *file, int line, void *ptr, size_t numBytes, int op) {
+  void *vp = NULL;
+  if (op == memopMalloc) {
+    vp = malloc(numBytes);
+  } else if (op == memopCalloc) {
+    vp = calloc(numBytes, 1);
+  } else if (op == memopFree) {
+    if (ptr) removeBlockLocked(ptr);
+    free(ptr);
+    return NULL;
+  } else {
+    // A failed realloc leaves the old block in place, so it's noted again.
+    size_t oldSize = 0;
+    if (ptr) {
+      pthread_mutex_lock(&mutex);
+      int64_t i = numBlockSlots ? findBlock(ptr) : 0;
+      if (numBlockSlots && blocks[i].ptr) oldSize = blocks[i].size;
+      removeBlock(ptr);
+      pthread_mutex_unlock(&mutex);
+    }
+    vp = realloc(ptr, numBytes);
+    if (vp == NULL && numBytes) addBlockAt(file, line, ptr, oldSize);
+  }
+  addBlockAt(file, line, vp, numBytes);
+  return vp;
+}
+
+char *memstrndup(const char *file, int line, const char *s, size_t maxLen) {
+  char *copy = strndup(s, maxLen);
+  if (copy) addBlockAt(file, line, copy, strlen(copy) + 1);
+  return copy;
+}
+
+void printmeminfo() {
+  pthread_mutex_lock(&mutex);
+  int   n      = numSites;
+  Site *sorted = malloc(n * sizeof(Site));
+  memcpy(sorted, sites, n * sizeof(Site));
+  int64_t live = liveBytes, peak = peakBytes, untracked = numUntrackedFrees;
+  pthread_mutex_unlock(&mutex);
+
+  qsort(sorted, n, sizeof(Site), compareByPeak);
+  printf("%32s %10s %10s %14s %12s %12s\n",
+         "site", "allocs", "frees", "total bytes", "live bytes", "peak bytes");
+  for (int i = 0; i < n; ++i) {
+    Site *site = &sorted[i];
+    if (site->numAllocs == 0) continue;
+    char name[64];
+    snprintf(name, sizeof(name), "%s:%d", site->file, site->line);
+    printf("%32s %10" PRId64 " %10" PRId64 " %14" PRId64 " %12" PRId64
+           " %12" PRId64 "\n", name, site->numAllocs, site->numFrees,
+           site->totalBytes, site->liveBytes, site->peakBytes);
+  }
+  printf("%32s: %" PRId64 " live bytes, %" PRId64 " peak bytes, %" PRId64
+         " frees of untracked blocks\n", "total", live, peak, untracked);
+  free(sorted);
+}
@@ -2,17 +2,46 @@
 //
 // https://github.com/tylerneylon/cstructs
 //
+// An allocation profiler. A file that includes this header after defining
+// DEBUG has its malloc, calloc, realloc, free, strdup and strndup calls routed
+// through memop, which notes the call site of each live block. Blocks are
+// charged to the site that made them until they're freed, wherever that
+// happens, so printmeminfo can list for each site its allocation count, total
+// bytes, live bytes and peak live bytes. It's safe to call from any thread.
+//
 
 #pragma once
 
-void *memop(char *file, int line, void *ptr, int numBytes, int isRealloc);
+// These are included first so that the macros below don't rename their
+// declarations.
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+// These are the values of memop's `op`.
+enum { memopMalloc, memopCalloc, memopRealloc, memopFree };
+
+void *memop(const char *file, int line, void *ptr, size_t numBytes, int op);
+char *memstrndup(const char *file, int line, const char *s, size_t maxLen);
 void printmeminfo();
 
-#if 1
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef strdup
+#undef strndup
 
-#define malloc(numBytes) memop(__FILE__, __LINE__, NULL, (int)numBytes, 0)
+#define malloc(numBytes) memop(__FILE__, __LINE__, NULL, numBytes, memopMalloc)
+#define calloc(num, size) \
+    memop(__FILE__, __LINE__, NULL, memcallocsize(num, size), memopCalloc)
 #define realloc(oldPtr, numBytes) \
-    memop(__FILE__, __LINE__, oldPtr, (int)numBytes, 1)
-#define free(ptr) memop(__FILE__, __LINE__, ptr, -1, 0)
+    memop(__FILE__, __LINE__, oldPtr, numBytes, memopRealloc)
+#define free(ptr) memop(__FILE__, __LINE__, ptr, 0, memopFree)
+#define strdup(s) memstrndup(__FILE__, __LINE__, s, (size_t)-1)
+#define strndup(s, maxLen) memstrndup(__FILE__, __LINE__, s, maxLen)
 
-#endif
+// This is the size of a calloc, or SIZE_MAX if it overflows; calloc would fail.
+static inline size_t memcallocsize(size_t num, size_t size) {
+  return (size && num > (size_t)-1 / size) ? (size_t)-1 : num * size;
+}
@@ -0,0 +1,35 @@
+// typed_array.h
+//
+// https://github.com/tylerneylon/cstructs
+//
+// Type-specialized accessors for an Array whose items all have one known type.
+// These work on a plain Array, including one in gap-buffer mode, but the
+// element size is known at compile time and the accessors are inline, so hot
+// loops avoid a function call and a multiply by item_size per item.
+//
+// Example:
+//   array__declare_typed(str_array, char *)
+// declares the item type str_array__item (= char *) and the inline function
+//   char **str_array__item_ptr(Array array, int64_t index);
+// after which you can loop with
+//   array__typed_for(str_array, str_ptr, array, index) { /* loop body */ }
+//
+
+#pragma once
+
+#include "array.h"
+
+#define array__declare_typed(name, type)                                      \
+  typedef type name##__item;                                                  \
+  static inline name##__item *name##__item_ptr(Array array, int64_t index) {  \
+    if (index >= array->gap_index) index += array->capacity - array->count;   \
+    return (name##__item *)array->items + index;                              \
+  }
+
+// This works like array__for, and it's safe to do the same things in the loop
+// body. The type of item_ptr is name##__item *.
+#define array__typed_for(name, item_ptr, array, index)                        \
+  for (int64_t index = 0, __tmpvar = 1; __tmpvar--;)                          \
+  for (name##__item *item_ptr = name##__item_ptr(array, index);               \
+       index < array->count;                                                  \
+       item_ptr = name##__item_ptr(array, ++index))
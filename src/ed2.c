@@ -8,13 +8,25 @@
 
 // Local includes.
 #include "global.h"
+#include "intern.h"
+#include "io.h"
+#include "memory.h"
+#include "progress.h"
+#include "record.h"
+#include "save.h"
+#include "search.h"
+#include "sort.h"
+#include "stats.h"
 #include "subst.h"
+#include "trace.h"
+#include "trigram.h"
 
 // Library includes.
 #include <readline/readline.h>
 
 // Standard includes.
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <regex.h>
 #include <stdio.h>
@@ -22,6 +34,12 @@
 #include <string.h>
 #include <sys/stat.h>
 
+// With make profile, allocations are counted by call site; the P command and
+// exiting print the counts.
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
 
 // ——————————————————————————————————————————————————————————————————————
 // Constants.
@@ -33,29 +51,20 @@
 // ——————————————————————————————————————————————————————————————————————
 // Globals.
 
-char   last_command[string_capacity];
-
-char   last_error[string_capacity];
 int    do_print_errors = 0;
 
-// The current filename.
-char   filename[string_capacity];
-
-// The lines are held in an array. The array frees removed lines for us.
-// The byte stream can be formed by joining this array with "\n".
-Array  lines = NULL;
+// This is set by the -g option; it puts the lines array in gap-buffer mode.
+int    use_gap_buffer = 0;
 
-int    current_line;  // This is 1-based.
-int    is_modified;   // This is set in save_state; it's called for edits.
+// This is set by the -z option, or by -m, which implies -z; it compresses lines
+// that go unused.
+int    use_cold_storage = 0;
 
-// `next_line` is used to help run global commands. Edit commands keep it
-// updated when lines before it are inserted or deleted.
-int    next_line = 0;  // Like current_line, this is 1-based.
-int    is_running_global = 0;  // This is 1 if a global command is running.
+// This is set by the -d option; it shares the strings of identical lines.
+int    use_interning = 0;
 
-// Data used for undos.
-Array  backup_lines = NULL;
-int    backup_current_line;
+// This is set by the -b option; it makes w save on a background thread.
+int    use_background_save = 0;
 
 
 // ——————————————————————————————————————————————————————————————————————
@@ -63,22 +72,67 @@ int    backup_current_line;
 
 // Backup functionality.
 
-static void deep_copy_array(Array src, Array dst) {
+// Cold lines are copied as handles, which share their block. With -d, other
+// lines are copied as references to their shared strings, except for lines
+// going into `lines` during a global command; see ed2__share_line. This returns
+// the bytes of the copied strings and of dst's items.
+static int64_t deep_copy_array(ed2__Editor *ed, Array src, Array dst) {
   array__clear(dst);
-  array__for(char **, line, src, i) {
-    array__new_val(dst, char *) = strdup(*line);
+  array__add_zeroed_items(dst, src->count);
+  int     do_share = use_interning &&
+                     !(dst == ed->lines && ed->is_running_global);
+  int64_t bytes    = src->count * sizeof(char *);
+  array__typed_for(line_array, line, src, i) {
+    char *copy = *line;
+    if (cold__is_cold(copy)) {
+      cold__retain(copy);
+    } else if (do_share) {
+      copy = intern__copy(copy);
+    } else {
+      copy = strdup(copy);
+      if (stats__is_on) bytes += strlen(copy) + 1;
+    }
+    *line_array__item_ptr(dst, i) = copy;
+  }
+  return bytes;
+}
+
+// A global command's backup is made by the first of its commands to save one,
+// so that undoing it, or interrupting it, restores the buffer as it was before
+// the global command.
+static void save_state(ed2__Editor *ed, Array saved_lines,
+                       int64_t *saved_current_line) {
+  ed->is_modified = 1;
+  if (saved_lines == ed->backup_lines) {
+    if (ed->is_running_global && ed->did_save_state) return;
+    ed->did_save_state = 1;
+  }
+  *saved_current_line = ed->current_line;
+  trace__begin("undo copy");
+  if (stats__is_on) {
+    double start = stats__now();
+    stats__command.undo_bytes += deep_copy_array(ed, ed->lines, saved_lines);
+    stats__command.num_undo_copies += 1;
+    stats__command.undo_seconds    += stats__now() - start;
+  } else {
+    deep_copy_array(ed, ed->lines, saved_lines);
   }
+  trace__end();
 }
 
-static void save_state(Array saved_lines, int *saved_current_line) {
-  is_modified = 1;
-  *saved_current_line = current_line;
-  deep_copy_array(lines, saved_lines);
+static void load_state_from_backup(ed2__Editor *ed) {
+  trace__begin("undo restore");
+  deep_copy_array(ed, ed->backup_lines, ed->lines);
+  cold__did_insert_lines(0, ed->lines->count);
+  ed->current_line = ed->backup_current_line;
+  trace__end();
 }
 
-static void load_state_from_backup() {
-  deep_copy_array(backup_lines, lines);
-  current_line = backup_current_line;
+// This puts the buffer back as it was before an interrupted command. Commands
+// that change the buffer save a backup first; others have nothing to undo.
+static void undo_interrupted_command(ed2__Editor *ed) {
+  if (ed->did_save_state) load_state_from_backup(ed);
+  ed->is_modified = ed->was_modified;
 }
 
 // File loading and saving functionality.
@@ -86,75 +140,132 @@ static void load_state_from_backup() {
 static void line_releaser(void *line_vp, void *context) {
   char *line = *(char **)line_vp;
   assert(line);
-  free(line);
+  ed2__free_line(line);
+}
+
+// Backup lines are copies that are never in `lines`, so they're freed directly,
+// unless -d is on; then a backup line may be the last reference to a string
+// that was in `lines`.
+static void backup_line_releaser(void *line_vp, void *context) {
+  char *line = *(char **)line_vp;
+  assert(line);
+  if (cold__is_cold(line)) cold__release(line);
+  else if (use_interning)  ed2__free_line(line);
+  else                     free(line);
 }
 
-static Array new_lines_array() {
+static Array new_lines_array(Releaser releaser) {
   Array new_array = array__new(64, sizeof(char *));
-  new_array->releaser = line_releaser;
+  new_array->releaser = releaser;
   return new_array;
 }
 
 // Initialize our data structures.
-static void setup_for_new_file() {
-  if (lines)        array__delete(lines);
-  if (backup_lines) array__delete(backup_lines);
+static void setup_for_new_file(ed2__Editor *ed) {
+  if (ed->lines)        array__delete(ed->lines);
+  if (ed->backup_lines) array__delete(ed->backup_lines);
 
-  lines               = new_lines_array();
-  is_modified         = 0;
+  ed->lines               = new_lines_array(line_releaser);
+  ed->is_modified         = 0;
+  array__set_gap_buffer(ed->lines, use_gap_buffer);
 
-  backup_lines        = new_lines_array();
-  backup_current_line = no_valid_backup;
+  ed->backup_lines        = new_lines_array(backup_line_releaser);
+  ed->backup_current_line = no_valid_backup;
 
   // This works with new/empty files as both the i=insert and a=append commands
   // will silently clamp their index to a valid point for the user.
-  current_line = 0;
-  next_line    = 0;
+  ed->current_line = 0;
+  ed->next_line    = 0;
 
-  strcpy(last_command, "");
+  strcpy(ed->last_command, "");
 }
 
-// Separate a raw buffer into a sequence of indexed lines.
-// Destroys the buffer in the process.
-static void break_into_lines(char *buffer) {
-  assert(lines);  // Check that lines has been initialized.
-  assert(buffer);
+// These are used to fill `lines` from a file. With -z, each chunk of lines is
+// compressed as soon as it's loaded, so the whole file is never held as
+// separate strings.
+
+static void start_loading(ed2__Editor *ed) {
+  assert(ed->lines);  // Check that lines has been initialized.
+  array__clear(ed->lines);
+  ed->backup_current_line = no_valid_backup;
+  ed->is_modified = 0;
+}
 
-  array__clear(lines);
-  backup_current_line = no_valid_backup;
-  is_modified = 0;
+static void add_loaded_line(ed2__Editor *ed, char *line) {
+  array__new_val(ed->lines, char *) = ed2__share_line(ed, strdup(line));
+  if (use_cold_storage && ed->lines->count % cold__chunk_lines == 0) {
+    cold__freeze_range(ed, ed->lines->count - cold__chunk_lines,
+                       ed->lines->count);
+  }
+}
 
-  char *buffer_ptr = buffer;
-  char *line;
-  while ((line = strsep(&buffer_ptr, "\n"))) {
-    array__new_val(lines, char *) = strdup(line);
+static void finish_loading(ed2__Editor *ed) {
+  if (stats__is_on) stats__command.num_lines += ed->lines->count;
+  if (use_cold_storage) {
+    int64_t count = ed->lines->count;
+    cold__freeze_range(ed, count - count % cold__chunk_lines, count);
   }
+  ed->current_line = last_line(ed);
+}
 
-  current_line = last_line;
+// This splits the file `fd` into lines a chunk at a time, while later chunks
+// are read in the background; with -z, the file needn't fit in memory. A file
+// ending in a newline gets an empty last line. It returns 0 on a read error and
+// 1 otherwise.
+static int read_lines(ed2__Editor *ed, int fd) {
+  start_loading(ed);
+  io__File file    = io__start_reading(fd);
+  Array    partial = array__new(64, 1);  // This is a line split across chunks.
+  char *   chunk;
+  size_t   len;
+  while ((chunk = io__read_chunk(file, &len))) {
+    record__add_file_bytes(chunk, len);
+    char *cursor = chunk;
+    char *end    = chunk + len;
+    char *newline;
+    while ((newline = memchr(cursor, '\n', end - cursor))) {
+      *newline = '\0';
+      if (partial->count) {
+        array__insert_items(partial, partial->count, cursor,
+                            newline - cursor + 1);  // + 1 for the null.
+        add_loaded_line(ed, partial->items);
+        array__clear(partial);
+      } else {
+        add_loaded_line(ed, cursor);
+      }
+      cursor = newline + 1;
+    }
+    array__insert_items(partial, partial->count, cursor, end - cursor);
+  }
+  array__new_val(partial, char) = '\0';
+  add_loaded_line(ed, partial->items);
+  array__delete(partial);
+  finish_loading(ed);
+  return io__stop(file);
 }
 
-// Load a file. Use the global `filename` unless `new_filename` is non-NULL, in
-// which case, the new name replaces the global filename and is loaded.
-static void load_file(char *new_filename, char *full_command) {
+// Load a file. Use the editor's `filename` unless `new_filename` is non-NULL,
+// in which case, the new name replaces the editor's filename and is loaded.
+static void load_file(ed2__Editor *ed, char *new_filename, char *full_command) {
 
   // Stop with a warning if the file is modified and they haven't tried before.
-  if (is_modified && strcmp(last_command, full_command) != 0) {
-    ed2__error(error__file_modified);
+  if (ed->is_modified && strcmp(ed->last_command, full_command) != 0) {
+    ed2__error(ed, error__file_modified);
     return;
   }
 
-  if (new_filename) strlcpy(filename, new_filename, string_capacity);
-  if (strlen(filename) == 0) {
-    ed2__error(error__no_current_filename);
+  if (new_filename) strlcpy(ed->filename, new_filename, string_capacity);
+  if (strlen(ed->filename) == 0) {
+    ed2__error(ed, error__no_current_filename);
     return;
   }
 
-  FILE *f = fopen(filename, "rb");
+  FILE *f = fopen(ed->filename, "rb");
 
   if (f == NULL) {
     if (errno == ENOENT) {
-      printf("%s: No such file or directory\n", filename);
-      setup_for_new_file();
+      printf("%s: No such file or directory\n", ed->filename);
+      setup_for_new_file(ed);
       return;
     }
     // Otherwise, the file exists but we couldn't open it.
@@ -165,22 +276,13 @@ static void load_file(char *new_filename, char *full_command) {
   int is_err = fstat(fileno(f), &file_stats);
   if (is_err) goto bad_read;
 
-  size_t buffer_size = file_stats.st_size;
-  char * buffer = malloc(buffer_size + 1);  // + 1 for the final null character.
-
-  int num_read = fread(buffer,       // buffer ptr
-                       1,            // item size
-                       buffer_size,  // num items
-                       f);           // stream
-  buffer[buffer_size] = '\0';        // Manually add a final null character.
-
-  if (num_read < buffer_size) goto bad_read;
-
+  trace__begin("load");
+  int did_read = read_lines(ed, fileno(f));
+  trace__end();
+  if (!did_read) goto bad_read;
   fclose(f);
-
-  break_into_lines(buffer);
-  free(buffer);
-  printf("%zd\n", buffer_size);  // Report how many bytes we read.
+  record__loaded_file(ed->filename, (int64_t)file_stats.st_size);
+  printf("%" PRId64 "\n", (int64_t)file_stats.st_size);  // Bytes we read.
   return;
 
 bad_read:
@@ -191,261 +293,440 @@ bad_read:
   exit(1);
 }
 
+// This ends any running background save, waiting for it if do_wait is set.
+static void end_save(ed2__Editor *ed, int do_wait) {
+  if (save__end(ed, do_wait) == -1) ed->is_modified = 1;
+}
+
 // Save the buffer. If filename is NULL, save it to the current filename.
-// This returns the number of bytes written on success and -1 on error.
-static int save_file(char *new_filename) {
-  if (new_filename) strlcpy(filename, new_filename, string_capacity);
-  if (strlen(filename) == 0) {
-    ed2__error(error__no_current_filename);
+// This returns the number of bytes written on success and -1 on error. With
+// is_in_background, it returns 0 once the save has started; the save is
+// reported when it ends.
+static int64_t save_file(ed2__Editor *ed, char *new_filename,
+                         int is_in_background) {
+  if (new_filename) strlcpy(ed->filename, new_filename, string_capacity);
+  if (strlen(ed->filename) == 0) {
+    ed2__error(ed, error__no_current_filename);
     return -1;
   }
 
-  FILE *f = fopen(filename, "wb");
-  if (f == NULL) {
+  io__Replacement replacement;
+  if (!io__start_replacement(&replacement, ed->filename)) {
     if (errno == EACCES) {  // A permission error has its own error string.
       char err_str[string_capacity];
-      snprintf(err_str, string_capacity, "%s: permission denied", filename);
-      ed2__error(err_str);
+      snprintf(err_str, string_capacity, "%s: permission denied", ed->filename);
+      ed2__error(ed, err_str);
     } else {
-      ed2__error(error__bad_write);  // Other write errors get a generic string.
+      ed2__error(ed, error__bad_write);  // Other errors get a generic string.
     }
     return -1;  // -1 --> indicate error
   }
 
-  int nbytes_written = 0;
-  int was_error = 0;
-  array__for(char **, line, lines, i) {
-    int nbytes_this_line = 0;
-    if (i) nbytes_this_line += fwrite("\n", 1, 1, f);  // 1, 1 = size, nitems
-    size_t len = strlen(*line);
-    nbytes_this_line += fwrite(*line,  // buffer
-                               1,      // size
-                               len,    // nitems
-                               f);     // stream
-    if (nbytes_this_line < len + (i ? 1 : 0)) was_error = 1;
-    nbytes_written += nbytes_this_line;
+  if (is_in_background) {
+    ed->is_modified = 0;  // A failed save sets this again.
+    save__start(ed, &replacement);
+    return 0;
+  }
+
+  // The lines are joined into buffers that are written in the background.
+  trace__begin("save");
+  FILE *   f    = replacement.file;
+  io__File file = io__start_writing(fileno(f));
+  int64_t  nbytes_written = 0;
+  int      was_interrupted = 0;
+  progress__start_loop("w", ed->lines->count);
+  for (int64_t i = 0; i < ed->lines->count; ++i) {
+    if ((was_interrupted = progress__should_stop(i))) break;
+    char * line = line_text_at_index(ed, i);
+    size_t len  = strlen(line);
+    if (i) io__write(file, "\n", 1);
+    io__write(file, line, len);
+    nbytes_written += len + (i ? 1 : 0);
+  }
+  progress__end_loop();
+  int was_error = !io__stop(file);
+  if (fclose(f) != 0) was_error = 1;
+  if (!io__end_replacement(&replacement, !was_interrupted && !was_error)) {
+    was_error = 1;
   }
+  trace__end();
 
+  if (was_interrupted) {
+    ed2__error(ed, error__interrupted);
+    return -1;
+  }
   if (was_error) {
-    ed2__error(error__bad_write);
+    ed2__error(ed, error__bad_write);
     return -1;  // -1 --> indicate error
   }
 
-  is_modified = 0;
-  fclose(f);
-  printf("%d\n", nbytes_written);  // Report how many bytes we wrote.
+  ed->is_modified = 0;
+  printf("%" PRId64 "\n", nbytes_written);  // Report how many bytes we wrote.
   return nbytes_written;
 }
 
 // Parsing functions.
 
 // This returns the number of characters scanned.
-static int scan_line_number(char *command, int *num) {
+static int scan_line_number(char *command, int64_t *num) {
   int num_chars_parsed;
-  int num_items_parsed = sscanf(command, "%d%n", num, &num_chars_parsed);
+  int num_items_parsed = sscanf(command, "%" SCNd64 "%n",
+                                num, &num_chars_parsed);
   return (num_items_parsed > 0 ? num_chars_parsed : 0);
 }
 
+// This parses a single address, which is a line number, /re/ or ?re?. It
+// returns the number of characters parsed, 0 if there's no address, or -1 if a
+// search failed; in that case an error has been reported.
+static int parse_address(ed2__Editor *ed, char *command, int64_t *line) {
+  if (*command != '/' && *command != '?') {
+    return scan_line_number(command, line);
+  }
+
+  // Like ed, we're chill about a missing delimiter at the end of the command.
+  char   delimiter   = *command;
+  char * pattern_end = strchr(command + 1, delimiter);
+  if (pattern_end == NULL) pattern_end = command + strlen(command);
+  size_t pattern_len = pattern_end - (command + 1);
+  char * pattern     = calloc(pattern_len + 1, 1);  // + 1 for the final null
+  memcpy(pattern, command + 1, pattern_len);
+
+  int is_backward = (delimiter == '?');
+  *line = search__find_line(ed, pattern, ed->current_line, is_backward);
+  free(pattern);
+  if (*line == 0) return -1;  // search__find_line reported the error.
+
+  return (int)(pattern_end - command) + (*pattern_end ? 1 : 0);
+}
+
 // Functions to help execute editing/printing commands.
 
-static void print_line(int line_num, int do_add_number) {
-  if (do_add_number) printf("%d\t", line_num);
-  printf("%s\n", line_at_index(line_num - 1));
+static void print_line(ed2__Editor *ed, int64_t line_num, int do_add_number) {
+  if (stats__is_on) stats__command.num_lines += 1;
+  if (do_add_number) printf("%" PRId64 "\t", line_num);
+  printf("%s\n", line_text_at_index(ed, line_num - 1));
 }
 
 // This enters multi-line input mode. It accepts lines of input, including
 // meaningful blank lines, until a line with a single period is given.
 // The lines are appended to the end of the given `lines` Array.
-static void read_in_lines(Array lines) {
+static void read_in_lines(ed2__Editor *ed, Array lines) {
   while (1) {
-    char *line = readline("");  // We own the memory of `line`.
+    char *line = record__read_input();  // We own the memory of `line`.
     if (line == NULL || strcmp(line, ".") == 0) return;
-    array__new_val(lines, char *) = line;
+    array__new_val(lines, char *) = ed2__share_line(ed, line);
   }
 }
 
 // Enters line-reading mode and inserts the lines at the given 0-based index.
 // This means exactly the first `index` lines are left untouched.
-static void read_and_insert_lines_at_index(int index) {
+static void read_and_insert_lines_at_index(ed2__Editor *ed, int64_t index) {
   // Silently clamp the index to legal values.
   if (index < 0)            index = 0;
-  if (index > lines->count) index = lines->count;
+  if (index > ed->lines->count) index = ed->lines->count;
   Array new_lines = array__new(16, sizeof(char *));
-  read_in_lines(new_lines);
+  read_in_lines(ed, new_lines);
   // If we're appending lines at the end of the buffer, ensure the files ends in
   // a newline. Our overall position on ending newlines is to keep the original
   // state unless the user adds lines; in that case we ensure an ending newline.
-  if (index == lines->count &&
+  if (index == ed->lines->count &&
       *array__item_val(new_lines, new_lines->count - 1, char *) != '\0') {
-    array__new_val(new_lines, char *) = strdup("");
+    array__new_val(new_lines, char *) = ed2__share_line(ed, strdup(""));
   }
-  array__insert_items(lines, index, new_lines->items, new_lines->count);
-  current_line += new_lines->count;
-  if ((next_line - 1) >= index) next_line += new_lines->count;
+  array__insert_items(ed->lines, index, new_lines->items, new_lines->count);
+  ed2__did_insert_lines(index, new_lines->count);
+  ed->current_line += new_lines->count;
+  if ((ed->next_line - 1) >= index) ed->next_line += new_lines->count;
   array__delete(new_lines);
 }
 
 // Returns true iff the range is bad.
-static int err_if_bad_range(int start, int end) {
-  if (start < 1 || end > last_line) {
-    ed2__error(error__invalid_address);
+static int err_if_bad_range(ed2__Editor *ed, int64_t start, int64_t end) {
+  if (start < 1 || end > last_line(ed)) {
+    ed2__error(ed, error__invalid_address);
     return 1;
   }
   return 0;
 }
 
 // Returns true iff the new current line is bad.
-static int err_if_bad_current_line(int new_current_line) {
-  if (new_current_line < 1 || new_current_line > last_line) {
-    ed2__error(error__invalid_address);
+static int err_if_bad_current_line(ed2__Editor *ed, int64_t new_current_line) {
+  if (new_current_line < 1 || new_current_line > last_line(ed)) {
+    ed2__error(ed, error__invalid_address);
     return 1;
   }
-  current_line = new_current_line;
+  ed->current_line = new_current_line;
   return 0;
 }
 
 // Print out the given lines; useful for the p or empty commands.
 // This simply produces an error if the range is invalid.
-static void print_range(int start, int end, int do_number_lines) {
-  dbg_printf("%s(%d, %d, do_number_lines=%d)\n", __FUNCTION__,
-             start, end, do_number_lines);
-  if (err_if_bad_range(start, end)) return;
-  for (int i = start; i <= end; ++i) print_line(i, do_number_lines);
+static void print_range(ed2__Editor *ed, int64_t start, int64_t end,
+                        int do_number_lines) {
+  dbg_printf("%s(%" PRId64 ", %" PRId64 ", do_number_lines=%d)\n",
+             __FUNCTION__, start, end, do_number_lines);
+  if (err_if_bad_range(ed, start, end)) return;
+  for (int64_t i = start; i <= end; ++i) print_line(ed, i, do_number_lines);
 }
 
-static void delete_range(int start, int end) {
-  if (err_if_bad_range(start, end)) return;
-  for (int n = end - start + 1; n > 0; --n) {
-    array__remove_item(lines, array__item_ptr(lines, start - 1));
+// This adds the text of the strings in `some_lines` to `text`. Cold lines are
+// counted with their blocks and shared lines with the shared-line table.
+static void add_text_usage(memory__Usage *text, Array some_lines) {
+  array__typed_for(line_array, line, some_lines, i) {
+    if (cold__is_cold(*line))                      continue;
+    if (use_interning && intern__is_shared(*line)) continue;
+    memory__add_string(text, *line);
   }
-  if (start <= next_line && next_line <= end) next_line = start;
-  if (next_line > end) next_line -= (end - start + 1);
-  current_line = (start <= last_line ? start : last_line);
 }
 
-static void join_range(int start, int end, int is_default_range) {
+// This prints the memory used by the buffer and its side structures.
+static void print_memory_usage(ed2__Editor *ed) {
+  enum { line_text, lines_table, undo_text, undo_table, matched, cached,
+         index, cold_blocks, shared_text, shared_table, num_rows };
+  memory__Row rows[num_rows] = {
+    [line_text]    = { "line text" },
+    [lines_table]  = { "lines table" },
+    [undo_text]    = { "undo text" },
+    [undo_table]   = { "undo table" },
+    [matched]      = { "g matched set" },
+    [cached]       = { "g cached results" },
+    [index]        = { "trigram index" },
+    [cold_blocks]  = { "cold blocks" },
+    [shared_text]  = { "shared text" },
+    [shared_table] = { "shared table" }
+  };
+  add_text_usage(&rows[line_text].usage, ed->lines);
+  memory__add_array(&rows[lines_table].usage, ed->lines);
+  add_text_usage(&rows[undo_text].usage, ed->backup_lines);
+  memory__add_array(&rows[undo_table].usage, ed->backup_lines);
+  global__add_memory_usage(&rows[matched].usage, &rows[cached].usage);
+  trigram__add_memory_usage(&rows[index].usage);
+  cold__add_memory_usage(&rows[cold_blocks].usage);
+  intern__add_memory_usage(&rows[shared_text].usage,
+                           &rows[shared_table].usage);
+
+  // Rows after the undo table are only shown if they're in use.
+  int num_shown = 0;
+  for (int i = 0; i < num_rows; ++i) {
+    if (i > undo_table && rows[i].usage.num_blocks == 0) continue;
+    rows[num_shown++] = rows[i];
+  }
+  memory__print_report(rows, num_shown);
+}
+
+static void delete_range(ed2__Editor *ed, int64_t start, int64_t end) {
+  if (err_if_bad_range(ed, start, end)) return;
+  int64_t num_lines = end - start + 1;
+  progress__start_loop("d", num_lines);
+  for (int64_t n = 0; n < num_lines; ++n) {
+    if (progress__should_stop(n)) {
+      ed2__did_remove_lines(start - 1, n);
+      ed2__error(ed, error__interrupted);
+      progress__end_loop();
+      return;
+    }
+    array__remove_item(ed->lines, line_array__item_ptr(ed->lines, start - 1));
+  }
+  progress__end_loop();
+  ed2__did_remove_lines(start - 1, num_lines);
+  if (start <= ed->next_line && ed->next_line <= end) ed->next_line = start;
+  if (ed->next_line > end) ed->next_line -= (end - start + 1);
+  ed->current_line = (start <= last_line(ed) ? start : last_line(ed));
+}
+
+static void join_range(ed2__Editor *ed, int64_t start, int64_t end,
+                       int is_default_range) {
   // 1. Establish and check the validity of the range.
   if (is_default_range) {
-    start = current_line;
-    end   = current_line + 1;
+    start = ed->current_line;
+    end   = ed->current_line + 1;
   }
-  if (err_if_bad_range(start, end)) return;
-  if (start == end) return;
+  if (err_if_bad_range(ed, start, end)) return;
+  if (start >= end) return;  // On an empty buffer, , gives start = 1, end = 0.
 
   // 2. Calculate the size we need.
   size_t joined_len = 1;  // Start at 1 for the null terminator.
-  for (int i = start; i <= end; ++i) joined_len += strlen(line_at_index(i - 1));
+  for (int64_t i = start; i <= end; ++i) {
+    joined_len += strlen(line_text_at_index(ed, i - 1));
+  }
 
-  // 3. Allocate, join, and set the new line.
+  // 3. Allocate, join, and set the new line. Appending with stpcpy copies each
+  //    byte once, where strcat would rescan the joined part for every line.
   char *new_line = malloc(joined_len);
-  new_line[0] = '\0';
-  for (int i = start; i <= end; ++i) strcat(new_line, line_at_index(i - 1));
-  free(line_at_index(start - 1));
-  line_at_index(start - 1) = new_line;
-  // This method is valid because of the range checks at the function start.
-  for (int i = start + 1; i <= end; ++i) {
-    array__remove_item(lines, array__item_ptr(lines, i - 1));
+  if (stats__is_on) stats__command.new_line_bytes += joined_len;
+  char *cursor   = new_line;
+  *cursor = '\0';
+  for (int64_t i = start; i <= end; ++i) {
+    cursor = stpcpy(cursor, line_text_at_index(ed, i - 1));
   }
+  ed2__free_line(line_id_at_index(ed, start - 1));
+  line_id_at_index(ed, start - 1) = ed2__share_line(ed, new_line);
+  // This method is valid because of the range checks at the function start.
+  // The joined lines after the first are at indexes [start, end).
+  array__remove_items(ed->lines, start, end - start);
+  ed2__did_remove_lines(start, end - start);
 
-  if (start <= next_line && next_line <= end) next_line = start;
-  if (next_line > end) next_line -= (end - start);
+  if (start <= ed->next_line && ed->next_line <= end) ed->next_line = start;
+  if (ed->next_line > end) ed->next_line -= (end - start);
 
-  current_line = start;  // The current line is the newly joined line.
+  ed->current_line = start;  // The current line is the newly joined line.
 }
 
 // Moves the range [start, end] to be after the text currently at line dst.
-static void move_lines(int start, int end, int dst) {
-  if (start < 1 || end < start || last_line < end) {
-    ed2__error(error__invalid_range);
+static void move_lines(ed2__Editor *ed, int64_t start, int64_t end,
+                       int64_t dst) {
+  if (start < 1 || end < start || last_line(ed) < end) {
+    ed2__error(ed, error__invalid_range);
     return;
   }
   if (start <= dst && dst < end) {
-    ed2__error(error__invalid_dst);
+    ed2__error(ed, error__invalid_dst);
     return;
   }
 
   // 1. Deep copy the lines being moved so we can call delete_range later.
   Array moving_lines = array__new(end - start + 1, sizeof(char *));
-  for (int i = start; i <= end; ++i) {
-    array__new_val(moving_lines, char *) = strdup(line_at_index(i - 1));
+  for (int64_t i = start; i <= end; ++i) {
+    char *copy = strdup(line_text_at_index(ed, i - 1));
+    array__new_val(moving_lines, char *) = ed2__share_line(ed, copy);
   }
 
   // 2. Append the deep copy after dst.
-  array__insert_items(lines, dst, moving_lines->items, moving_lines->count);
-  if ((next_line - 1) >= dst) next_line += moving_lines->count;
+  array__insert_items(ed->lines, dst, moving_lines->items, moving_lines->count);
+  ed2__did_insert_lines(dst, moving_lines->count);
+  if ((ed->next_line - 1) >= dst) ed->next_line += moving_lines->count;
   array__delete(moving_lines);
 
   // 3. Remove the original range.
-  int range_len = end - start + 1;
-  int offset    = (dst > end ? 0 : range_len);
-  delete_range(start + offset, end + offset);  // This updates next_line.
+  int64_t range_len = end - start + 1;
+  int64_t offset    = (dst > end ? 0 : range_len);
+  delete_range(ed, start + offset, end + offset);  // This updates next_line.
 
-  current_line = dst + offset;
+  ed->current_line = dst + offset;
 }
 
 
 // ——————————————————————————————————————————————————————————————————————
 // Public functions.
 
-void ed2__error(const char *err_str) {
-  strcpy(last_error, err_str);
+void ed2__error(ed2__Editor *ed, const char *err_str) {
+  strcpy(ed->last_error, err_str);
   printf("?\n");
-  if (do_print_errors) printf("%s\n", last_error);
+  if (do_print_errors) printf("%s\n", ed->last_error);
 }
 
 // This parses out any initial line range from a command, returning the number
 // of characters parsed. If a range is successfully parsed, then current_line is
 // updated to the end of this range.
-int ed2__parse_range(char *command, int *start, int *end) {
+int ed2__parse_range(ed2__Editor *ed, char *command, int64_t *start,
+                     int64_t *end) {
 
-  // For now, we'll parse ranges of the following types:
+  // For now, we'll parse ranges of the following types, where <addr> is an
+  // <int>, a forward search /re/, or a backward search ?re?:
   //  * <no range>
   //  * ,
   //  * %
-  //  * <int>
-  //  * <int>,
-  //  * <int>,<int>
+  //  * <addr>
+  //  * <addr>,
+  //  * <addr>,<addr>
+  // Each search starts at the current line as it is when the search is parsed.
 
   // Set up the default range.
-  *start = *end = current_line;
+  *start = *end = ed->current_line;
 
   int parsed = 0;
 
   // The ',' and '%' cases.
   if (*command == ',' || *command == '%') {
     *start = 1;
-    current_line = *end = last_line;
+    ed->current_line = *end = last_line(ed);
     return 1;  // Parsed 1 character.
   }
 
-  int num_chars_parsed = scan_line_number(command, start);
+  int num_chars_parsed = parse_address(ed, command, start);
+  if (num_chars_parsed < 0) return -1;
   parsed += num_chars_parsed;
 
   // The <no range> case.
   if (num_chars_parsed == 0) return parsed;
 
-  // The <int> case.
-  current_line = *end = *start;
+  // The <addr> case.
+  ed->current_line = *end = *start;
   if (*(command + parsed) != ',') return parsed;
 
   parsed++;  // Skip over the ',' character.
-  num_chars_parsed = scan_line_number(command + parsed, end);
+  num_chars_parsed = parse_address(ed, command + parsed, end);
+  if (num_chars_parsed < 0) return -1;
   parsed += num_chars_parsed;
-  if (num_chars_parsed > 0) current_line = *end;
+  if (num_chars_parsed > 0) ed->current_line = *end;
 
-  // The <int>,<int> and <int>, cases.
+  // The <addr>,<addr> and <addr>, cases.
   return parsed;
 }
 
-void ed2__run_command(char *command) {
+int ed2__skip_range(char *command) {
+  char *cursor = command;
+  while (1) {
+    if (isdigit((unsigned char)*cursor) || *cursor == ',' || *cursor == '%') {
+      cursor++;
+    } else if (*cursor == '/' || *cursor == '?') {
+      char *pattern_end = strchr(cursor + 1, *cursor);
+      cursor = pattern_end ? pattern_end + 1 : cursor + strlen(cursor);
+    } else {
+      return (int)(cursor - command);
+    }
+  }
+}
+
+void ed2__free_line(char *line) {
+  if (use_interning && !cold__is_cold(line) && !intern__release(line)) return;
+  global__forget_line(line);
+  if (cold__is_cold(line)) {
+    cold__release(line);
+    return;
+  }
+  if (save__hold_line(line)) return;
+  trigram__free_line(line);
+}
+
+// Lines made during a global command aren't shared, since pass 2 of the command
+// finds the lines to visit by pointer; a new copy of a matched line mustn't be
+// mistaken for it.
+char *ed2__share_line(ed2__Editor *ed, char *line) {
+  if (!use_interning || ed->is_running_global) return line;
+  return intern__line(line);
+}
+
+void ed2__did_insert_lines(int64_t index, int64_t num_lines) {
+  if (stats__is_on) stats__command.num_lines += num_lines;
+  global__did_insert_lines(index, num_lines);
+  trigram__did_insert_lines(index, num_lines);
+  cold__did_insert_lines(index, num_lines);
+}
+
+void ed2__did_remove_lines(int64_t index, int64_t num_lines) {
+  if (stats__is_on) stats__command.num_lines += num_lines;
+  global__did_remove_lines(index, num_lines);
+  trigram__did_remove_lines(index, num_lines);
+}
+
+void ed2__did_relocate_line(int64_t index, char *old_line, char *new_line) {
+  global__did_relocate_line(index, old_line, new_line);
+  trigram__did_relocate_line(index, old_line, new_line);
+}
+
+void ed2__run_command(ed2__Editor *ed, char *command) {
 
   char *full_command = command;
   dbg_printf("run command: \"%s\"\n", command);
+  if (trace__is_on) trace__begin_event("run command", command);
 
-  int start, end;
-  int num_range_chars = ed2__parse_range(command, &start, &end);
+  int64_t start, end;
+  int num_range_chars = ed2__parse_range(ed, command, &start, &end);
+  if (num_range_chars < 0) goto finally;
   command += num_range_chars;
-  dbg_printf("After parse_range, s=%d e=%d c=\"%s\"\n", start, end, command);
+  dbg_printf("After parse_range, s=%" PRId64 " e=%" PRId64 " c=\"%s\"\n",
+             start, end, command);
   int is_default_range = (num_range_chars == 0);
 
   // First consider commands that may have a suffix.
@@ -454,28 +735,30 @@ void ed2__run_command(char *command) {
   switch(*command) {
     case 'm':  // Move the range to right after the line given as a suffix num.
       {
-        save_state(backup_lines, &backup_current_line);
-        int dst_line;
+        save_state(ed, ed->backup_lines, &ed->backup_current_line);
+        int64_t dst_line;
         int num_chars_parsed = scan_line_number(command + 1, &dst_line);
-        if (num_chars_parsed == 0) dst_line = current_line;
-        move_lines(start, end, dst_line);
+        if (num_chars_parsed == 0) dst_line = ed->current_line;
+        move_lines(ed, start, end, dst_line);
         goto finally;
       }
 
     case 'w':  // Save the buffer to a file.
       {
-        char *new_filename = NULL;  // NULL makes save_file use the global name.
+        char *new_filename = NULL;  // NULL means save_file uses ed->filename.
         int do_quit = 0;
         if (*++command != '\0') {
           if (*command == 'q' && *(command + 1) == '\0') {
             do_quit = 1;
           } else if (*command != ' ') {
-            ed2__error(error__bad_cmd_suffix);
+            ed2__error(ed, error__bad_cmd_suffix);
           } else {
             new_filename = ++command;
           }
         }
-        int ret_code = save_file(new_filename);
+        end_save(ed, 1);  // 1 = wait for it
+        int64_t ret_code = save_file(ed, new_filename,
+                                     use_background_save && !do_quit);
         if (do_quit && ret_code != -1) {  // ret_code -1 means save_file failed.
           exit(0);
         }
@@ -484,15 +767,16 @@ void ed2__run_command(char *command) {
 
     case 'e':  // Load a file.
       {
-        char *new_filename = NULL;  // NULL makes load_file use the global name.
+        char *new_filename = NULL;  // NULL means load_file uses ed->filename.
         if (*++command != '\0') {
           if (*command != ' ') {
-            ed2__error(error__bad_cmd_suffix);
+            ed2__error(ed, error__bad_cmd_suffix);
           } else {
             new_filename = ++command;
           }
         }
-        load_file(new_filename, full_command);
+        end_save(ed, 1);  // 1 = wait for it
+        load_file(ed, new_filename, full_command);
         goto finally;
       }
 
@@ -501,23 +785,39 @@ void ed2__run_command(char *command) {
         char *pattern;
         char *repl;
         int   is_global;
-        int   did_work = subst__parse_params(++command, &pattern,
-                                             &repl, &is_global);
+        int   match_flags;
+        int   did_work = subst__parse_params(ed, ++command, &pattern, &repl,
+                                             &is_global, &match_flags);
         if  (!did_work) goto finally;
-        save_state(backup_lines, &backup_current_line);
-        subst__on_lines(pattern, repl, start, end, is_global);
+        save_state(ed, ed->backup_lines, &ed->backup_current_line);
+        subst__on_lines(ed, pattern, repl, start, end, is_global, match_flags);
         free(pattern);
         free(repl);
         goto finally;
       }
+
+    case 'o':  // Sort (order) lines; the whole buffer by default.
+    case 'U':  // Remove adjacent duplicate (non-Unique) lines.
+      {
+        sort__Flags flags;
+        if (!sort__parse_flags(ed, command + 1, &flags)) goto finally;
+        if (is_default_range) {
+          start = 1;
+          end   = last_line(ed);
+        }
+        save_state(ed, ed->backup_lines, &ed->backup_current_line);
+        if (*command == 'o') sort__sort_lines(ed, start, end, flags);
+        else                 sort__uniq_lines(ed, start, end, flags);
+        goto finally;
+      }
   }
 
   // *command still points at the command character.
   // All commands below expect zero suffix, so we can reliably given an error
   // message here - and *not* run the command - if we see a suffix.
 
-  if (*(command + 1) != '\0') {
-    ed2__error(error__bad_cmd_suffix);
+  if (*command != '\0' && *(command + 1) != '\0') {
+    ed2__error(ed, error__bad_cmd_suffix);
     goto finally;
   }
 
@@ -528,13 +828,14 @@ void ed2__run_command(char *command) {
     case 'q':
       {
         if (!is_default_range) {
-          ed2__error(error__unexpected_address);
+          ed2__error(ed, error__unexpected_address);
           break;
         }
+        end_save(ed, 1);  // 1 = wait for it
         // Stop with a warning if the file is modified and they haven't tried
         // before.
-        if (is_modified && strcmp(last_command, full_command) != 0) {
-          ed2__error(error__file_modified);
+        if (ed->is_modified && strcmp(ed->last_command, full_command) != 0) {
+          ed2__error(ed, error__file_modified);
           break;
         }
         exit(0);
@@ -542,15 +843,16 @@ void ed2__run_command(char *command) {
 
     case '\0': // If no range was given, advance a line. Print current_line.
       {
-        if (is_default_range && !is_running_global) {
-          if (err_if_bad_current_line(current_line + 1)) goto finally;
+        if (is_default_range && !ed->is_running_global) {
+          if (err_if_bad_current_line(ed, ed->current_line + 1)) goto finally;
         }
-        print_range(current_line, current_line, 0);  // 0 = don't add line num
+        // 0 = don't add line num
+        print_range(ed, ed->current_line, ed->current_line, 0);
         break;
       }
 
     case '=':  // Print the range's end line num, or last line num on no range.
-      printf("%d\n", (is_default_range ? last_line : end));
+      printf("%" PRId64 "\n", (is_default_range ? last_line(ed) : end));
       break;
 
     case 'n':  // Print lines with added line numbers.
@@ -558,79 +860,100 @@ void ed2__run_command(char *command) {
       // Purposefully fall through to the next case.
 
     case 'p':  // Print all lines in the effective range.
-      print_range(start, end, do_number_lines);
+      print_range(ed, start, end, do_number_lines);
       break;
 
     case 'h':  // Print last error, if there was one.
-      if (last_error[0]) printf("%s\n", last_error);
+      if (ed->last_error[0]) printf("%s\n", ed->last_error);
       break;
       
     case 'H':  // Toggle error printing.
       do_print_errors = !do_print_errors;
       break;
 
+    case 'T':  // Toggle timing of each command.
+      stats__toggle();
+      break;
+
+    case 'S':  // Print the timing totals for each kind of command.
+      stats__print_totals();
+      break;
+
+    case 'M':  // Print the memory used by the buffer and its side structures.
+      print_memory_usage(ed);
+      break;
+
+#ifdef DEBUG
+    case 'P':  // Print the allocations of each call site.
+      printmeminfo();
+      break;
+#endif
+
     case 'a':  // Append new lines.
-      save_state(backup_lines, &backup_current_line);
+      save_state(ed, ed->backup_lines, &ed->backup_current_line);
       // This inserts at line number current_line + 1 = appending.
-      read_and_insert_lines_at_index(current_line);
+      read_and_insert_lines_at_index(ed, ed->current_line);
       break;
 
     case 'i':  // Insert new lines.
-      save_state(backup_lines, &backup_current_line);
-      read_and_insert_lines_at_index(current_line - 1);
+      save_state(ed, ed->backup_lines, &ed->backup_current_line);
+      read_and_insert_lines_at_index(ed, ed->current_line - 1);
       break;
 
     case 'd':  // Delete lines in the effective range.
-      save_state(backup_lines, &backup_current_line);
-      delete_range(start, end);
+      save_state(ed, ed->backup_lines, &ed->backup_current_line);
+      delete_range(ed, start, end);
       break;
 
     case 'c':  // Change effective range lines into newly input lines.
       {
-        save_state(backup_lines, &backup_current_line);
-        int is_ending_range = (end == last_line);
-        delete_range(start, end);
-        int insert_index = is_ending_range ? last_line : current_line - 1;
-        read_and_insert_lines_at_index(insert_index);
+        save_state(ed, ed->backup_lines, &ed->backup_current_line);
+        int is_ending_range = (end == last_line(ed));
+        delete_range(ed, start, end);
+        if (progress__should_stop(0)) break;
+        int64_t insert_index = is_ending_range ? last_line(ed) :
+                                                 ed->current_line - 1;
+        read_and_insert_lines_at_index(ed, insert_index);
         break;
       }
 
     case 'j':  // Join the lines in the effective rnage.
-      save_state(backup_lines, &backup_current_line);
-      join_range(start, end, is_default_range);
+      save_state(ed, ed->backup_lines, &ed->backup_current_line);
+      join_range(ed, start, end, is_default_range);
       break;
 
     case 'u':  // Undo the last change, if there was one.
       {
         // First, check that a backup exists.
-        if (backup_current_line == no_valid_backup) {
-          ed2__error(error__no_backup);
+        if (ed->backup_current_line == no_valid_backup) {
+          ed2__error(ed, error__no_backup);
           goto finally;
         }
 
         // 1. Current state -> swap.
-        Array swap_lines = new_lines_array();
-        int   swap_current_line;
-        save_state(swap_lines, &swap_current_line);
+        Array swap_lines = new_lines_array(backup_line_releaser);
+        int64_t swap_current_line;
+        save_state(ed, swap_lines, &swap_current_line);
 
         // 2. Backup -> current state.
-        load_state_from_backup();
+        load_state_from_backup(ed);
 
         // 3. Swap -> backup.
-        array__delete(backup_lines);
-        backup_lines        = swap_lines;
-        backup_current_line = swap_current_line;
+        array__delete(ed->backup_lines);
+        ed->backup_lines        = swap_lines;
+        ed->backup_current_line = swap_current_line;
         break;
       }
 
     default:  // If we get here, the command wasn't recognized.
-      ed2__error(error__bad_cmd);
+      ed2__error(ed, error__bad_cmd);
   }
 
 finally:
 
   // Save the command to know when it's repeated. Used by the 'q', 'e' commands.
-  strlcpy(last_command, full_command, string_capacity);
+  strlcpy(ed->last_command, full_command, string_capacity);
+  trace__end();
 }
 
 
@@ -639,20 +962,79 @@ finally:
 
 int main(int argc, char **argv) {
 
-  // Initialization.
-  strcpy(last_error, "");
-  setup_for_new_file();
+#ifdef DEBUG
+  atexit(printmeminfo);
+#endif
+
+  // Parse options; these come before any filename.
+  char *recording_path = NULL;
+  char *trace_path     = NULL;
+  int   arg_index      = 1;
+  progress__init();
+  for (; arg_index < argc && argv[arg_index][0] == '-'; ++arg_index) {
+    if (strcmp(argv[arg_index], "-g") == 0) {
+      use_gap_buffer = 1;
+    } else if (strcmp(argv[arg_index], "-i") == 0) {
+      trigram__enable();
+    } else if (strcmp(argv[arg_index], "-z") == 0) {
+      use_cold_storage = 1;
+    } else if (strcmp(argv[arg_index], "-m") == 0 && arg_index + 1 < argc &&
+               atoi(argv[arg_index + 1]) > 0) {
+      use_cold_storage = 1;
+      cold__set_budget((size_t)atoi(argv[++arg_index]) << 20);  // In MB.
+    } else if (strcmp(argv[arg_index], "-d") == 0) {
+      use_interning = 1;
+    } else if (strcmp(argv[arg_index], "-b") == 0) {
+      use_background_save = 1;
+    } else if (strcmp(argv[arg_index], "-u") == 0) {
+      io__disable_uring();
+    } else if (strcmp(argv[arg_index], "-r") == 0 && arg_index + 1 < argc) {
+      recording_path = argv[++arg_index];
+    } else if (strcmp(argv[arg_index], "-t") == 0 && arg_index + 1 < argc) {
+      trace_path = argv[++arg_index];
+    } else if (strcmp(argv[arg_index], "-p") == 0 && arg_index + 1 < argc) {
+      progress__show_after(atof(argv[++arg_index]));
+    } else {
+      printf("usage: ed2 [-g] [-i] [-z] [-m megabytes] [-d] [-b] [-u] "
+             "[-r recording] [-t trace] [-p seconds] [filename]\n");
+      exit(1);
+    }
+  }
+  if (recording_path) {
+    // The recording notes the options other than -r, -t and their paths.
+    char *options[16];
+    int   num_options = 0;
+    for (int i = 1; i < arg_index && num_options < 16; ++i) {
+      if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "-t") == 0) {
+        i++;  // This skips the path.
+      } else {
+        options[num_options++] = argv[i];
+      }
+    }
+    if (!record__start(recording_path, options, num_options)) {
+      printf("%s: can't write the recording\n", recording_path);
+      exit(1);
+    }
+  }
+  if (trace_path && !trace__start(trace_path)) {
+    printf("%s: can't write the trace\n", trace_path);
+    exit(1);
+  }
 
-  if (argc < 2) {
-    // The empty string indicates no filename has been given yet.
-    filename[0] = '\0';
-  } else {
-    strlcpy(filename, argv[1], string_capacity);
-    load_file(NULL,  // NULL --> use the global filename
-              "");   // ""   --> treat full_command as an empty string
+  // Initialization. The editor starts with no filename and no last error.
+  ed2__Editor *ed = calloc(1, sizeof(ed2__Editor));
+  setup_for_new_file(ed);
+
+  if (arg_index < argc) {
+    strlcpy(ed->filename, argv[arg_index], string_capacity);
+    load_file(ed, NULL,  // NULL --> use the editor's filename
+              "");       // ""   --> treat full_command as an empty string
+    trigram__start_build(ed);
     if (show_debug_output) {
       printf("File contents:'''\n");
-      array__for(char **, line, lines, i) printf(i ? "\n%s" : "%s", *line);
+      for (int64_t i = 0; i < ed->lines->count; ++i) {
+        printf(i ? "\n%s" : "%s", line_text_at_index(ed, i));
+      }
       printf("'''\n");
     }
   }
@@ -660,12 +1042,28 @@ int main(int argc, char **argv) {
   // Enter our read-eval-print loop (REPL).
   while (1) {
     char *line = readline("");  // We own the memory of `line`.
+    record__command(line);
+    stats__start_command(line);
+    if (trace__is_on) trace__begin_event("command", line);
+    progress__start_command();
+    ed->did_save_state = 0;
+    ed->was_modified   = ed->is_modified;
     if (global__is_global_command(line)) {
       global__read_rest_of_command(&line);
-      global__parse_and_run_command(line);
+      trigram__lock();
+      global__parse_and_run_command(ed, line);
     } else {
-      ed2__run_command(line);  // This may exit the program.
+      trigram__lock();
+      ed2__run_command(ed, line);  // This may exit the program.
     }
+    if (progress__end_command()) undo_interrupted_command(ed);
+    cold__end_command(ed);
+    end_save(ed, 0);  // 0 = only if it's done
+    trigram__start_build(ed);
+    trigram__unlock();
+    record__end_command();
+    stats__end_command();
+    trace__end();
     free(line);
   }
 
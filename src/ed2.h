@@ -3,13 +3,45 @@
 // An ed-like text editor.
 //
 // Usage:
-//   ed2 [filename]
+//   ed2 [-g] [-i] [-z] [-m megabytes] [-d] [-b] [-u] [-r recording]
+//       [-t trace] [-p seconds] [filename]
 //
 // Opens filename if present, or a new buffer if no filename is given.
 // Edit/save the buffer with essentially the same commands as the original
 // ed text editor.
 //
-// This header declares globals and functions to be used by other modules.
+// The -g option keeps the lines in a gap buffer, which makes runs of edits
+// near the same line fast in large files.
+//
+// The -i option keeps a trigram index of the lines, which lets g, v, s and
+// searches skip most lines when their pattern contains a literal.
+//
+// The -z option compresses lines that haven't been used for a few commands;
+// see cold.h. The -m option implies -z and keeps the compressed lines within
+// the given number of megabytes of memory, moving the rest out to a scratch
+// file, so that files larger than memory can be edited.
+//
+// The -d option shares one copy of each distinct line among all the lines with
+// that text; see intern.h.
+//
+// The -b option makes the w command save on a background thread, so editing
+// can go on while a large buffer is written; see save.h.
+//
+// The -u option reads and writes files with an I/O thread even where io_uring
+// is available; see io.h.
+//
+// The -r option records the session's input and each command's time to the
+// given file, so the session can be replayed; see record.h.
+//
+// The -t option writes a timeline of each command's phases to the given file,
+// for viewing in Perfetto or chrome://tracing; see trace.h.
+//
+// An interrupt stops a long s, g, v, d or w and undoes what it had done. The
+// -p option shows the progress of loops that run longer than the given number
+// of seconds; see progress.h.
+//
+// This header declares the editor type and the functions and globals to be
+// used by other modules.
 //
 // One difficulty of this program is that users think in terms of line numbers
 // that begin with 1 while C code thinks in terms of indexes that start with 0.
@@ -20,54 +52,133 @@
 
 #pragma once
 
+#include "cold.h"
 #include "cstructs/cstructs.h"
 
+#include <inttypes.h>
+
 
 // ——————————————————————————————————————————————————————————————————————
-// Public globals.
+// Public types and globals.
 
-// Most constants are defined below, but this one helps define last_error.
+// Most constants are defined below, but this one helps define ed2__Editor.
 #define string_capacity 1024
 
-// `next_line` is used to help run global commands. Edit commands keep it
-// updated when lines before it are inserted or deleted.
-extern int next_line;     // This is 1-based.
-extern int current_line;  // This is 1-based.
-extern int is_running_global;  // This is 1 if a global command is running.
+// An editor is a buffer and the state of editing it. Commands act on the
+// editor they're given. The options below apply to every editor, and the side
+// structures kept for -z, -i, -d and global commands still serve one editor at
+// a time.
+typedef struct ed2__Editor {
+  // The lines are held in an array. The array frees removed lines for us.
+  // The byte stream can be formed by joining this array with "\n".
+  Array   lines;
+
+  // Line numbers are 64-bit so that buffers may hold more than 2^31 lines.
+  int64_t current_line;  // This is 1-based.
+
+  // `next_line` is used to help run global commands. Edit commands keep it
+  // updated when lines before it are inserted or deleted.
+  int64_t next_line;          // Like current_line, this is 1-based.
+  int     is_running_global;  // This is 1 if a global command is running.
+
+  int     is_modified;  // This is set in save_state; it's called for edits.
 
-// The lines are held in an array. The array frees removed lines for us.
-// The byte stream can be formed by joining this array with "\n".
-extern Array lines;
+  // Data used for undos. The user can't undo when there's no valid backup.
+  Array   backup_lines;
+  int64_t backup_current_line;
 
-// An empty string indicates there was no known last error.
-extern char last_error[string_capacity];
+  // These are set as each command starts, so that an interrupted command can
+  // be undone.
+  int     did_save_state;  // This is set when the command saves a backup.
+  int     was_modified;
+
+  // An empty string indicates there was no known last error.
+  char    last_error[string_capacity];
+
+  // The q and e commands use this to notice when they're repeated.
+  char    last_command[string_capacity];
+
+  // The empty string indicates no filename has been given yet.
+  char    filename[string_capacity];
+} ed2__Editor;
+
+extern int use_cold_storage;  // This is set by the -z or -m option.
 
 
 // ——————————————————————————————————————————————————————————————————————
 // Public functions.
 
-// By default, this prints '?' and updates the last_error string.
-void ed2__error(const char *err_str);
+// By default, this prints '?' and updates the editor's last_error string.
+void ed2__error(ed2__Editor *ed, const char *err_str);
 
 // This runs the given command string.
-void ed2__run_command(char *command);
+void ed2__run_command(ed2__Editor *ed, char *command);
+
+// This frees a line that has been removed from, or replaced in, `lines`. Other
+// modules refer to lines by pointer, so they're told the line is gone first.
+void ed2__free_line(char *line);
+
+// This takes a new line made with malloc that is about to be put into the
+// editor's lines and returns the line to put there instead; with -d, that's
+// the shared copy of its text.
+char *ed2__share_line(ed2__Editor *ed, char *line);
+
+// These tell modules that keep data beside each line index that lines were
+// inserted into or removed from `lines`, so they can keep that data lined up.
+void ed2__did_insert_lines(int64_t index, int64_t num_lines);
+void ed2__did_remove_lines(int64_t index, int64_t num_lines);
+
+// This tells modules that key data by line pointer that the item at `index` of
+// `lines` changed from `old_line` to `new_line` without its text changing, as
+// when a line is compressed or thawed.
+void ed2__did_relocate_line(int64_t index, char *old_line, char *new_line);
 
 // This parses out any initial line range from a command, returning the number
 // of characters parsed. If a range is successfully parsed, then current_line is
-// updated to the end of this range.
-int  ed2__parse_range(char *command, int *start, int *end);
+// updated to the end of this range. Addresses may be regex searches, in which
+// case this returns -1 after reporting an error if a search fails.
+int  ed2__parse_range(ed2__Editor *ed, char *command, int64_t *start,
+                      int64_t *end);
+
+// This returns the number of characters in any initial line range of a command
+// without evaluating the range, so it runs no searches and changes nothing.
+int  ed2__skip_range(char *command);
 
 
 // ——————————————————————————————————————————————————————————————————————
 // Public macros and constants.
 
+// Inline, char *-specialized accessors for an editor's lines, and for other
+// arrays of lines such as the undo backup. This declares
+// line_array__item_ptr().
+array__declare_typed(line_array, char *)
+
+// This returns the item of ed->lines at `index`, thawing it first if it's cold.
+static inline char **ed2__line_slot(ed2__Editor *ed, int64_t index) {
+  if (use_cold_storage) cold__touch(ed, index);
+  return line_array__item_ptr(ed->lines, index);
+}
+
 // This can be used for both setting and getting.
 // Don't forget to free the old value if setting.
-#define line_at_index(index) array__item_val(lines, index, char *)
+#define line_at_index(ed, index) (*ed2__line_slot(ed, index))
+
+// This is the item of ed->lines at `index` as it is, which may be a cold
+// handle. It's stable until the line is edited, thawed or compressed.
+#define line_id_at_index(ed, index) (*line_array__item_ptr((ed)->lines, index))
+
+// This returns the text of the line at `index` without thawing it. Only read
+// from the result, and only until the next call.
+static inline char *line_text_at_index(ed2__Editor *ed, int64_t index) {
+  char *line = line_id_at_index(ed, index);
+  return cold__is_cold(line) ? cold__text_at_index(ed, index) : line;
+}
 
-// This provides the last line number.
-#define last_line \
-    (*line_at_index(lines->count - 1) ? lines->count : lines->count - 1)
+// This provides the editor's last line number.
+static inline int64_t last_line(ed2__Editor *ed) {
+  int64_t count = ed->lines->count;
+  return *line_text_at_index(ed, count - 1) ? count : count - 1;
+}
 
 #define max_matches 10
 
@@ -90,12 +201,14 @@ int  ed2__parse_range(char *command, int *start, int *end);
 #define error__no_current_filename  "no current filename"
 #define error__bad_write            "error while writing"
 #define error__bad_read             "error: file may exist but couldn't read it"
+#define error__bad_scratch_read     "error: couldn't read the scratch file"
 
 // Regex-related.
 #define error__no_slash_in_s_cmd    "expected '/' after s command"
 #define error__bad_regex_start      "expected '/' to start regular expression"
 #define error__bad_regex_end        "expected '/' to end regular expression"
 #define error__no_match             "no match"
+#define error__no_prev_pattern      "no previous pattern"
 
 // Address or command related.
 #define error__invalid_address      "invalid address"
@@ -107,3 +220,4 @@ int  ed2__parse_range(char *command, int *start, int *end);
 
 // Command-specific errors.
 #define error__no_backup            "nothing to undo"
+#define error__interrupted          "interrupted"
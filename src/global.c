@@ -7,15 +7,59 @@
 // Local includes.
 #include "cstructs/cstructs.h"
 #include "ed2.h"
-
-// Library includes.
-#include <readline/readline.h>
+#include "matcher.h"
+#include "progress.h"
+#include "record.h"
+#include "search.h"
+#include "trace.h"
 
 // Standard includes.
 #include <assert.h>
 #include <regex.h>
+#include <stdlib.h>
 #include <string.h>
 
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// While a global command runs, this is the set of `char *` lines that matched.
+static Map matched_lines = NULL;
+
+// This is the last line of the running global command's range. The edit hooks
+// below keep it up to date, so that pass 2 stays within the range; with -d,
+// lines outside it may share a pointer with a matched line.
+static int64_t range_end = 0;
+
+// We keep regex results for the most recent patterns so that re-running a
+// global command only runs the regex on lines that changed since the last run.
+// Result i is for line index i if its `line` pointer still matches and that
+// line hasn't been freed since results were last checked; the freed_lines set
+// keeps a new line at a reused address from picking up an old result.
+#define max_cached_patterns 4
+
+typedef struct {
+  char *line;
+  int   is_match;
+} CachedResult;
+
+// This declares result_array__item_ptr().
+array__declare_typed(result_array, CachedResult)
+
+typedef struct {
+  char *pattern;
+  int   flags;        // These are the matcher__ flags used with `pattern`.
+  Array results;      // This has CachedResult items.
+  Map   freed_lines;  // This is a set of `char *` lines.
+} MatchCache;
+
+static MatchCache match_caches[max_cached_patterns];  // Most recent first.
+static int        num_match_caches = 0;
+
 
 // ——————————————————————————————————————————————————————————————————————
 // Internal functions.
@@ -29,82 +73,180 @@ static int eq_lines(void *line1_vptr, void *line2_vptr) {
   return line1_vptr == line2_vptr;
 }
 
+// Returns the cache for `pattern` and `flags`, moved to the front of
+// match_caches. If it isn't there, an empty one is made, replacing the least
+// recently used; its results are a gap buffer when the lines of `ed` are, so
+// that edits near each other stay cheap in both.
+static MatchCache *match_cache_for_pattern(ed2__Editor *ed, char *pattern,
+                                           int flags) {
+  int i = 0;
+  while (i < num_match_caches &&
+         (match_caches[i].flags != flags ||
+          strcmp(match_caches[i].pattern, pattern))) {
+    i++;
+  }
+  MatchCache cache;
+  if (i < num_match_caches) {
+    cache = match_caches[i];
+  } else {
+    if (num_match_caches < max_cached_patterns) num_match_caches++;
+    i = num_match_caches - 1;
+    if (match_caches[i].pattern) {
+      free(match_caches[i].pattern);
+      array__delete(match_caches[i].results);
+      map__delete(match_caches[i].freed_lines);
+    }
+    cache.pattern     = strdup(pattern);
+    cache.flags       = flags;
+    cache.results     = array__new(64, sizeof(CachedResult));
+    array__set_gap_buffer(cache.results, ed->lines->is_gap_buffer);
+    cache.freed_lines = map__new(hash_line, eq_lines);
+  }
+  memmove(match_caches + 1, match_caches, i * sizeof(MatchCache));
+  match_caches[0] = cache;
+  return &match_caches[0];
+}
+
+// Returns the cached result for the line of `ed` at `index`, or NULL if it's
+// unknown.
+static CachedResult *cached_result(ed2__Editor *ed, MatchCache *cache,
+                                   int64_t index) {
+  if (index >= cache->results->count) {
+    array__add_zeroed_items(cache->results,
+                            ed->lines->count - cache->results->count);
+  }
+  CachedResult *result = result_array__item_ptr(cache->results, index);
+  char *line = line_id_at_index(ed, index);
+  if (result->line != line) return NULL;
+  if (cache->freed_lines->count && map__get(cache->freed_lines, line)) {
+    return NULL;
+  }
+  return result;
+}
+
 // `commands` is an Array with `char *` items; each is a single-line command
-// that can be executed with a call to ed2__run_command.
-static void run_global_command(int start, int end, char *pattern,
-                               Array commands, int is_inverted) {
-  is_running_global = 1;
-  dbg_printf("%s(start=%d, end=%d, pattern='%s', <commands>)\n",
-             __FUNCTION__, start, end, pattern);
+// that can be executed with a call to ed2__run_command. `match_flags` are the
+// matcher__ flags for `pattern`.
+static void run_global_command(ed2__Editor *ed, int64_t start, int64_t end,
+                               char *pattern, int match_flags, Array commands,
+                               int is_inverted) {
+  ed->is_running_global = 1;
+  dbg_printf("%s(start=%" PRId64 ", end=%" PRId64 ", pattern='%s', "
+             "<commands>)\n", __FUNCTION__, start, end, pattern);
 
   // Save the current error string so we can notice any execution errors.
   char   saved_error[string_capacity];
-  strcpy(saved_error, last_error);
-  strcpy( last_error, "");
+  strcpy(saved_error, ed->last_error);
+  strcpy( ed->last_error, "");
 
   // We run the command using two passes:
   // 1. Build a Map-based set of lines in the range that match `regex`, and
-  // 2. Use the `next_line` global to go through the file once, running
+  // 2. Use the editor's `next_line` to go through the file once, running
   //    `commands` on each matching line. `next_line` is kept up to date even
   //    when other commands edit the buffer.
 
   // Declare variables early if they're used in the finally goto-target block.
 
-  Map matched_lines = NULL;
+  search__Filter filter = { .literal = NULL };
 
   // Pass 1: Build the set of matching lines.
 
-  // 1A: Compile the regex pattern.
-  regex_t compiled_re;
-  int compile_flags = REG_EXTENDED;
+  // 1A: Compile the pattern.
+  matcher__Matcher matcher;
   char err_str[string_capacity];
   err_str[0] = '\0';
-  int err_code = regcomp(&compiled_re, pattern, compile_flags);
-  if (err_code) {
-    regerror(err_code, &compiled_re, err_str, string_capacity);
-    ed2__error(err_str);
+  trace__begin("compile");
+  int is_bad_pattern = matcher__compile(&matcher, pattern, match_flags,
+                                        err_str);
+  trace__end();
+  if (is_bad_pattern) {
+    ed2__error(ed, err_str);
     goto finally;
   }
 
-  // 1B: Find all currently matching lines.
+  // 1B: Find all currently matching lines. Cached results are used when we
+  //     have them, and the filter lets us skip the regex on lines that can't
+  //     match.
+  trace__begin("pass 1");
   matched_lines = map__new(hash_line, eq_lines);
-  int exec_flags  = 0;
-  for (int i = start; i <= end; ++i) {
-    regmatch_t matches[max_matches];
-    int err_code = regexec(&compiled_re, line_at_index(i - 1), max_matches,
-                           &matches[0], exec_flags);
-    if ((!is_inverted && err_code == 0) ||
-        ( is_inverted && err_code == REG_NOMATCH)) {
-      map__set(matched_lines, line_at_index(i - 1), 0);
-    } else if (err_code && err_code != REG_NOMATCH && err_str[0] == '\0') {
-      regerror(err_code, &compiled_re, err_str, string_capacity);
-      ed2__error(err_str);
+  search__init_filter(&filter, pattern, match_flags);
+  MatchCache *cache = match_cache_for_pattern(ed, pattern, match_flags);
+  progress__start_loop("g, matching", end - start + 1);
+  for (int64_t i = start; i <= end; ++i) {
+    if (progress__should_stop(i - start)) {
+      ed2__error(ed, error__interrupted);
+      progress__end_loop();
+      trace__end();
       goto finally;
     }
+    // Lines are keyed by their items in `lines`, which may be cold handles.
+    char *line = line_id_at_index(ed, i - 1);
+    CachedResult *result = cached_result(ed, cache, i - 1);
+    if (result == NULL) {
+      int err_code = REG_NOMATCH;
+      if (search__may_match(ed, &filter, i - 1)) {
+        regmatch_t matches[max_matches];
+        err_code = matcher__exec(&matcher, line_text_at_index(ed, i - 1),
+                                 max_matches, &matches[0], 0);
+      }
+      if (err_code && err_code != REG_NOMATCH) {
+        matcher__error(&matcher, err_code, err_str);
+        ed2__error(ed, err_str);
+        progress__end_loop();
+        trace__end();
+        goto finally;
+      }
+      result = result_array__item_ptr(cache->results, i - 1);
+      result->line     = line;
+      result->is_match = (err_code == 0);
+    }
+    if (result->is_match != is_inverted) map__set(matched_lines, line, 0);
   }
+  progress__end_loop();
+
+  // Once every result has been checked, no result can refer to a freed line.
+  if (start == 1 && end == last_line(ed)) {
+    map__clear(cache->freed_lines);
+    if (cache->results->count > ed->lines->count) {
+      array__remove_items(cache->results, ed->lines->count,
+                          cache->results->count - ed->lines->count);
+    }
+  }
+
+  trace__end();
 
   // Pass 2: Run `commands` on each matching line.
 
-  for (next_line = 1; next_line <= last_line;) {
-    if (!map__get(matched_lines, line_at_index(next_line - 1))) {
-      next_line++;  // Skip to the next line if this one doesn't match.
+  trace__begin("pass 2");
+  range_end = end;
+  progress__start_loop("g", end - start + 1);
+  for (ed->next_line = start; ed->next_line <= range_end;) {
+    if (ed->last_error[0]) break;  // Stop early on errors.
+    if (progress__should_stop(ed->next_line - start)) {
+      ed2__error(ed, error__interrupted);
+      break;
+    }
+    if (!map__get(matched_lines, line_id_at_index(ed, ed->next_line - 1))) {
+      ed->next_line++;  // Skip to the next line if this one doesn't match.
       continue;
     }
-    current_line = next_line;
-    next_line++;
+    ed->current_line = ed->next_line;
+    ed->next_line++;
     array__for(char **, sub_cmd, commands, i) {
-      ed2__run_command(*sub_cmd);  // This updates next_line for us.
-      if (last_error[0]) goto finally;  // Stop early on errors.
+      ed2__run_command(ed, *sub_cmd);  // This updates next_line for us.
+      if (ed->last_error[0]) break;
     }
   }
+  progress__end_loop();
+  trace__end();
 
 finally:
-  // It appears correct to call regfree even if regcomp fails; see the comment
-  // at the first use of regfree for more details.
-  regfree(&compiled_re);
+  matcher__free(&matcher);
+  search__free_filter(&filter);
   if (matched_lines != NULL) map__delete(matched_lines);
-  if (last_error[0] == '\0') strcpy(last_error, saved_error);
-  is_running_global = 0;
+  matched_lines = NULL;
+  if (ed->last_error[0] == '\0') strcpy(ed->last_error, saved_error);
+  ed->is_running_global = 0;
 }
 
 // Returns 1 iff the given line ends with a backslash-escaped newline,
@@ -122,8 +264,7 @@ static int does_end_in_continuation(char *line) {
 // Returns 1 iff the given command is the first line of a global command.
 int global__is_global_command(char *command) {
   assert(command);
-  int start, end;
-  command += ed2__parse_range(command, &start, &end);
+  command += ed2__skip_range(command);
   return *command == 'g' || *command == 'v';
 }
 
@@ -135,7 +276,7 @@ int global__is_global_command(char *command) {
 // function may free and reallocate the memory at *line.
 void global__read_rest_of_command(char **line) {
   while (does_end_in_continuation(*line)) {
-    char *new_part = readline("");  // We own the memory of `new_part`.
+    char *new_part = record__read_input();  // We own the memory of new_part.
     // Append new_part to *line; the + 2 is for the newline and the null.
     size_t new_size = strlen(*line) + strlen(new_part) + 2;
     char * new_line = calloc(new_size, 1);  // count, size
@@ -149,17 +290,18 @@ void global__read_rest_of_command(char **line) {
   }
 }
 
-// This runs the given global command string, which is expected to be in the
-// format that's read in by global__read_rest_of_command.
-void global__parse_and_run_command(char *command) {
+// This runs the given global command string on `ed`. The string is expected to
+// be in the format that's read in by global__read_rest_of_command.
+void global__parse_and_run_command(ed2__Editor *ed, char *command) {
   // Parse the command.
   assert(command);
-  int start, end;
-  int num_range_chars = ed2__parse_range(command, &start, &end);
+  int64_t start, end;
+  int num_range_chars = ed2__parse_range(ed, command, &start, &end);
+  if (num_range_chars < 0) return;
   command += num_range_chars;
   if (num_range_chars == 0) {
     start = 1;
-    end   = last_line;
+    end   = last_line(ed);
   }
   assert(*command == 'g' || *command == 'v');
   int is_inverted = (*command == 'v');
@@ -167,19 +309,23 @@ void global__parse_and_run_command(char *command) {
 
   // Parse the regular expression.
   if (*command != '/') {
-    ed2__error(error__bad_regex_start);
+    ed2__error(ed, error__bad_regex_start);
     return;
   }
   command++;
   char *regex = command;  // This memory remains owned by the caller.
   while (*command && *command != '/') command++;
   if (*command != '/') {
-    ed2__error(error__bad_regex_end);
+    ed2__error(ed, error__bad_regex_end);
     return;
   }
   *command = '\0';  // This is the null terminator for the regex string.
   command++;
 
+  // Parse any case-insensitive or literal flags.
+  int match_flags = 0;
+  matcher__parse_flags(&command, &match_flags);
+
   // Make a list out of the command sequence.
   // The commands list holds weak pointers into `command`; this memory
   // will be freed by the caller after this function completes.
@@ -195,5 +341,69 @@ void global__parse_and_run_command(char *command) {
     (*sub_cmd)[strlen(*sub_cmd) - 1] = '\0';
   }
 
-  run_global_command(start, end, regex, commands, is_inverted);
+  run_global_command(ed, start, end, regex, match_flags, commands,
+                     is_inverted);
+}
+
+void global__forget_line(char *line) {
+  if (matched_lines) map__unset(matched_lines, line);
+  for (int i = 0; i < num_match_caches; ++i) {
+    MatchCache *cache = &match_caches[i];
+    if (cache->results->count == 0) continue;
+    map__set(cache->freed_lines, line, 0);
+    // When most lines are gone, as after an undo, it's cheaper to start over.
+    if (cache->freed_lines->count > cache->results->count / 4) {
+      array__clear(cache->results);
+      map__clear(cache->freed_lines);
+    }
+  }
+}
+
+void global__did_relocate_line(int64_t index, char *old_line,
+                               char *new_line) {
+  if (matched_lines && map__get(matched_lines, old_line)) {
+    map__unset(matched_lines, old_line);
+    map__set(matched_lines, new_line, 0);
+  }
+  for (int i = 0; i < num_match_caches; ++i) {
+    Array results = match_caches[i].results;
+    if (index >= results->count) continue;
+    CachedResult *result = result_array__item_ptr(results, index);
+    if (result->line == old_line) result->line = new_line;
+  }
+}
+
+void global__did_insert_lines(int64_t index, int64_t num_lines) {
+  if (matched_lines && index < range_end) range_end += num_lines;
+  for (int i = 0; i < num_match_caches; ++i) {
+    Array results = match_caches[i].results;
+    if (index > results->count || num_lines <= 0) continue;
+    array__insert_zeroed_items(results, index, num_lines);
+  }
+}
+
+void global__did_remove_lines(int64_t index, int64_t num_lines) {
+  if (matched_lines && index < range_end) {
+    int64_t last_removed = index + num_lines;  // This is 1-based.
+    range_end -= (last_removed < range_end ? last_removed : range_end) - index;
+  }
+  for (int i = 0; i < num_match_caches; ++i) {
+    Array results = match_caches[i].results;
+    if (index >= results->count || num_lines <= 0) continue;
+    // Each cache's results may end at a different index.
+    int64_t num_removed = num_lines;
+    if (index + num_removed > results->count) {
+      num_removed = results->count - index;
+    }
+    array__remove_items(results, index, num_removed);
+  }
+}
+
+void global__add_memory_usage(memory__Usage *matched, memory__Usage *cached) {
+  memory__add_map(matched, matched_lines);
+  for (int i = 0; i < num_match_caches; ++i) {
+    memory__add_string(cached, match_caches[i].pattern);
+    memory__add_array(cached, match_caches[i].results);
+    memory__add_map(cached, match_caches[i].freed_lines);
+  }
 }
@@ -5,6 +5,11 @@
 
 #pragma once
 
+#include "ed2.h"
+#include "memory.h"
+
+#include <stdint.h>
+
 
 // ——————————————————————————————————————————————————————————————————————
 // Public functions.
@@ -19,6 +24,23 @@ int  global__is_global_command(char *command);
 // *line. This function may free and reallocate the memory at *line.
 void global__read_rest_of_command(char **line);
 
-// This runs the given global command string, which is expected to be in the
-// format that's read in by global__read_rest_of_command.
-void global__parse_and_run_command(char *command);
+// This runs the given global command string on `ed`. The string is expected to
+// be in the format that's read in by global__read_rest_of_command.
+void global__parse_and_run_command(ed2__Editor *ed, char *command);
+
+// This drops `line` from the set of lines a running global command has yet to
+// visit and from the cached regex results. It's called before a line is freed
+// so that a new line reusing the same memory isn't mistaken for it.
+void global__forget_line(char *line);
+
+// These keep the cached regex results lined up with the editor's lines.
+void global__did_insert_lines(int64_t index, int64_t num_lines);
+void global__did_remove_lines(int64_t index, int64_t num_lines);
+
+// This moves what's known about the line at `index` from `old_line` to
+// `new_line`, which has the same text.
+void global__did_relocate_line(int64_t index, char *old_line, char *new_line);
+
+// This adds the set of lines a running global command matched to `matched`,
+// and the cached regex results to `cached`.
+void global__add_memory_usage(memory__Usage *matched, memory__Usage *cached);
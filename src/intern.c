@@ -0,0 +1,91 @@
+// intern.c
+//
+
+// Header for this file.
+#include "intern.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+
+// Standard includes.
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// This maps each shared string to its number of references. Lookups are by
+// text, so a line that isn't shared may find a different string with the
+// same text; it's shared only if the key is the line itself.
+static Map shared_lines = NULL;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// The next two functions are for the shared_lines hash map. The hash is
+// FNV-1a; the map mixes it further.
+static int hash_text(void *line_vptr) {
+  uint32_t h = 2166136261u;
+  for (unsigned char *c = line_vptr; *c; ++c) h = (h ^ *c) * 16777619u;
+  return (int)h;
+}
+
+static int eq_text(void *line1_vptr, void *line2_vptr) {
+  return strcmp(line1_vptr, line2_vptr) == 0;
+}
+
+// Returns the pair for `line` itself, or NULL if `line` isn't shared.
+static map__key_value *shared_pair(char *line) {
+  if (shared_lines == NULL) return NULL;
+  map__key_value *pair = map__get(shared_lines, line);
+  return (pair && pair->key == line) ? pair : NULL;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+char *intern__line(char *line) {
+  if (shared_lines == NULL) shared_lines = map__new(hash_text, eq_text);
+  map__key_value *pair = map__get(shared_lines, line);
+  if (pair) {
+    pair->value = (void *)((intptr_t)pair->value + 1);
+    free(line);
+    return pair->key;
+  }
+  map__set(shared_lines, line, (void *)(intptr_t)1);
+  return line;
+}
+
+char *intern__copy(char *line) {
+  map__key_value *pair = shared_pair(line);
+  if (pair == NULL) return intern__line(strdup(line));
+  pair->value = (void *)((intptr_t)pair->value + 1);
+  return line;
+}
+
+int intern__release(char *line) {
+  map__key_value *pair = shared_pair(line);
+  if (pair == NULL) return 1;
+  pair->value = (void *)((intptr_t)pair->value - 1);
+  if (pair->value) return 0;
+  map__unset(shared_lines, line);
+  return 1;
+}
+
+int intern__is_shared(char *line) {
+  return shared_pair(line) != NULL;
+}
+
+void intern__add_memory_usage(memory__Usage *text, memory__Usage *table) {
+  if (shared_lines == NULL) return;
+  memory__add_map(table, shared_lines);
+  map__for(pair, shared_lines) memory__add_string(text, pair->key);
+}
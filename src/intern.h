@@ -0,0 +1,43 @@
+// intern.h
+//
+// Optional sharing of identical lines.
+//
+// With the -d option, lines put into `lines` are looked up by content in a
+// hash table, and a line whose text is already in use becomes another
+// reference to the existing string instead of a new copy. Shared strings are
+// never changed in place; an edit makes a new line and releases the old one,
+// so each reference behaves as its own copy. The table keeps the reference
+// count of each shared string, so a shared line is still an ordinary `char *`
+// that other modules may compare, and the last release frees it as usual.
+//
+// Equal shared lines are the same pointer, so repetitive files such as logs
+// take far less memory, while files of mostly distinct lines pay for a table
+// slot per line.
+//
+
+#pragma once
+
+#include "memory.h"
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This takes a new line made with malloc and returns the shared string with
+// the same text, freeing `line` if that string already existed.
+char * intern__line(char *line);
+
+// This returns another reference to `line` if it's shared, and otherwise a
+// new shared string with its text.
+char * intern__copy(char *line);
+
+// This drops a reference to `line`. It returns 1 if the caller should now free
+// the line, as when it was the last reference or `line` isn't shared, and 0 if
+// other references remain.
+int    intern__release(char *line);
+
+// This returns 1 iff `line` is one of the shared strings.
+int    intern__is_shared(char *line);
+
+// This adds the shared strings to `text` and the table itself to `table`.
+void   intern__add_memory_usage(memory__Usage *text, memory__Usage *table);
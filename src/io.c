@@ -0,0 +1,621 @@
+// io.c
+//
+
+// Header for this file.
+#include "io.h"
+
+// Local includes.
+#include "trace.h"
+
+// Standard includes.
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// io_uring is used through raw system calls, as liburing isn't a dependency.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#ifdef __NR_io_uring_setup
+#define has_uring 1
+#endif
+#endif
+#endif
+
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+// This is how many buffers each file has, including the caller's.
+#define num_buffers 4
+
+// The full buffers are [first_full, first_full + num_full), mod num_buffers.
+// When reading, the I/O thread fills buffers and the caller empties them; the
+// caller's chunk counts as full until it asks for the next one. When writing,
+// the caller fills buffers and the I/O thread empties them. With io_uring there
+// is no I/O thread; see the io_uring section below.
+typedef struct Uring Uring;
+
+struct io__Ring {
+  int             fd;
+  int             is_writing;
+  char *          buffers[num_buffers];
+  size_t          lens[num_buffers];
+  int             first_full;
+  int             num_full;
+  int             is_held;       // When reading, the caller holds first_full.
+  int             caller_slot;   // When writing, the caller fills this buffer.
+  size_t          caller_len;    // This many bytes of it are filled.
+  int             is_done;       // No more buffers will be filled.
+  int             was_error;
+  int             is_threaded;   // This is 0 if the thread couldn't start.
+  Uring *         uring;         // This is NULL unless io_uring does the I/O.
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  did_change;
+};
+
+typedef struct io__Ring Ring;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// This is cleared by io__disable_uring, or once the kernel refuses io_uring.
+static int is_uring_enabled = 1;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// io_uring.
+
+// Where the kernel allows it, a file is read or written with io_uring instead
+// of an I/O thread. Each buffer covers a fixed range of the file. When reading,
+// every buffer not held by the caller has a read in flight, and the caller
+// waits only for the one it asks for next. When writing, each buffer the
+// caller fills is submitted at once, and the caller waits only when it needs
+// that buffer again. The caller does all of this on its own thread.
+
+#ifdef has_uring
+
+struct Uring {
+  int                  fd;
+  unsigned *           sq_head;
+  unsigned *           sq_tail;
+  unsigned *           sq_mask;
+  unsigned *           sq_array;
+  unsigned *           cq_head;
+  unsigned *           cq_tail;
+  unsigned *           cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *               maps[3];       // The SQ ring, the CQ ring and the SQEs.
+  size_t               map_sizes[3];
+
+  // A buffer's range starts at offsets[slot]; lens[slot] of the ring is how
+  // much of it to read or write, and num_done[slot] how much has been.
+  off_t                next_offset;
+  off_t                offsets[num_buffers];
+  size_t               num_done[num_buffers];
+  struct iovec         iovecs[num_buffers];
+  int                  is_pending[num_buffers];
+  int                  num_pending;
+  int                  is_stuck;      // The kernel may still use the buffers.
+};
+
+static Uring *new_uring() {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = (int)syscall(__NR_io_uring_setup, num_buffers, &params);
+  if (fd == -1) {
+    if (errno == ENOSYS || errno == EPERM) is_uring_enabled = 0;
+    return NULL;
+  }
+  Uring *uring = calloc(1, sizeof(Uring));
+  uring->fd           = fd;
+  uring->map_sizes[0] = params.sq_off.array +
+                        params.sq_entries * sizeof(unsigned);
+  uring->map_sizes[1] = params.cq_off.cqes +
+                        params.cq_entries * sizeof(struct io_uring_cqe);
+  uring->map_sizes[2] = params.sq_entries * sizeof(struct io_uring_sqe);
+  off_t map_offsets[] = { IORING_OFF_SQ_RING, IORING_OFF_CQ_RING,
+                          IORING_OFF_SQES };
+  for (int i = 0; i < 3; ++i) {
+    void *map = mmap(NULL, uring->map_sizes[i], PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, map_offsets[i]);
+    if (map == MAP_FAILED) {
+      for (int j = 0; j < i; ++j) munmap(uring->maps[j], uring->map_sizes[j]);
+      close(fd);
+      free(uring);
+      return NULL;
+    }
+    uring->maps[i] = map;
+  }
+  char *sq_ring   = uring->maps[0];
+  char *cq_ring   = uring->maps[1];
+  uring->sq_head  = (unsigned *)(sq_ring + params.sq_off.head);
+  uring->sq_tail  = (unsigned *)(sq_ring + params.sq_off.tail);
+  uring->sq_mask  = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+  uring->sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+  uring->cq_head  = (unsigned *)(cq_ring + params.cq_off.head);
+  uring->cq_tail  = (unsigned *)(cq_ring + params.cq_off.tail);
+  uring->cq_mask  = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+  uring->cqes     = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+  uring->sqes     = uring->maps[2];
+  return uring;
+}
+
+static void delete_uring(Uring *uring) {
+  for (int i = 0; i < 3; ++i) munmap(uring->maps[i], uring->map_sizes[i]);
+  close(uring->fd);
+  free(uring);
+}
+
+// This queues the rest of a buffer's read or write; it's submitted by the next
+// call to enter_uring. At most one is queued per buffer, so the submission
+// queue, which has num_buffers entries, can't overflow.
+static void queue_io(Ring *ring, int slot) {
+  Uring *uring = ring->uring;
+  size_t done  = uring->num_done[slot];
+  uring->iovecs[slot].iov_base = ring->buffers[slot] + done;
+  uring->iovecs[slot].iov_len  = ring->lens[slot] - done;
+
+  unsigned             tail  = *uring->sq_tail;
+  unsigned             index = tail & *uring->sq_mask;
+  struct io_uring_sqe *sqe   = &uring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode    = ring->is_writing ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd        = ring->fd;
+  sqe->addr      = (uint64_t)(uintptr_t)&uring->iovecs[slot];
+  sqe->len       = 1;  // This is the number of iovecs.
+  sqe->off       = uring->offsets[slot] + done;
+  sqe->user_data = slot;
+  uring->sq_array[index] = index;
+  __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  uring->is_pending[slot] = 1;
+  uring->num_pending++;
+}
+
+// This submits any queued reads and writes and, if do_wait is set, waits until
+// at least one has finished. It returns 0 if the kernel refuses.
+static int enter_uring(Uring *uring, int do_wait) {
+  while (1) {
+    unsigned to_submit = *uring->sq_tail -
+                         __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+    if (to_submit == 0 && !do_wait) return 1;
+    long result = syscall(__NR_io_uring_enter, uring->fd, to_submit,
+                          do_wait ? 1 : 0,
+                          do_wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (result >= 0 && (do_wait || result == to_submit)) return 1;
+    if (result == -1 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      return 0;
+    }
+  }
+}
+
+// This records that a read or write of `num_bytes`, or -errno, has finished.
+// Short reads and writes are continued; a read of 0 bytes is the end of the
+// file.
+static void finish_io(Ring *ring, int slot, int num_bytes) {
+  Uring *uring = ring->uring;
+  uring->is_pending[slot] = 0;
+  uring->num_pending--;
+  if (num_bytes == -EINTR || num_bytes == -EAGAIN) {
+    queue_io(ring, slot);
+    return;
+  }
+  if (num_bytes < 0 || (num_bytes == 0 && ring->is_writing)) {
+    ring->was_error = 1;
+    ring->is_done   = 1;
+    ring->lens[slot] = 0;  // When reading, the caller's chunks end here.
+    return;
+  }
+  uring->num_done[slot] += num_bytes;
+  if (num_bytes == 0) {
+    ring->is_done = 1;
+  } else if (uring->num_done[slot] < ring->lens[slot]) {
+    queue_io(ring, slot);
+    return;
+  }
+  ring->lens[slot] = uring->num_done[slot];
+}
+
+// This waits for at least one read or write to finish, and continues any that
+// came up short.
+static void wait_for_uring(Ring *ring) {
+  Uring *uring = ring->uring;
+  if (!enter_uring(uring, 1)) {
+    // The buffers in flight can't be waited for, so they're never freed.
+    uring->is_stuck    = 1;
+    uring->num_pending = 0;
+    ring->was_error    = 1;
+    ring->is_done      = 1;
+    for (int i = 0; i < num_buffers; ++i) {
+      uring->is_pending[i] = 0;
+      ring->lens[i]        = 0;
+    }
+    return;
+  }
+  trace__begin("uring completions");
+  unsigned head = *uring->cq_head;
+  while (head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cq_mask];
+    int slot      = (int)cqe->user_data;
+    int num_bytes = cqe->res;
+    __atomic_store_n(uring->cq_head, ++head, __ATOMIC_RELEASE);
+    finish_io(ring, slot, num_bytes);
+  }
+  trace__end();
+  if (!enter_uring(uring, 0)) ring->was_error = 1;
+}
+
+// This queues a read of the next range of the file into `slot`.
+static void queue_read(Ring *ring, int slot) {
+  Uring *uring = ring->uring;
+  uring->offsets[slot]  = uring->next_offset;
+  uring->num_done[slot] = 0;
+  uring->next_offset   += io__buffer_size;
+  ring->lens[slot]      = io__buffer_size;
+  queue_io(ring, slot);
+}
+
+// This sets up io_uring for `ring` if it's enabled and the file has an offset
+// to read or write at. It returns 0 if the I/O thread is needed instead.
+static int start_uring(Ring *ring) {
+  if (!is_uring_enabled) return 0;
+  off_t offset = lseek(ring->fd, 0, SEEK_CUR);
+  int   flags  = fcntl(ring->fd, F_GETFL);
+  if (offset == -1 || flags == -1 || (flags & O_APPEND)) return 0;
+  ring->uring = new_uring();
+  if (ring->uring == NULL) return 0;
+  ring->uring->next_offset = offset;
+  if (!ring->is_writing) {
+    for (int i = 0; i < num_buffers; ++i) queue_read(ring, i);
+    if (!enter_uring(ring->uring, 0)) ring->was_error = 1;
+  }
+  return 1;
+}
+
+static char *uring_read_chunk(Ring *ring, size_t *len) {
+  Uring *uring = ring->uring;
+  if (ring->is_held) {
+    int slot = ring->first_full;
+    ring->is_held    = 0;
+    ring->first_full = (slot + 1) % num_buffers;
+    ring->lens[slot] = 0;
+    if (!ring->is_done) {
+      queue_read(ring, slot);
+      if (!enter_uring(uring, 0)) ring->was_error = 1;
+    }
+  }
+  int slot = ring->first_full;
+  while (uring->is_pending[slot]) wait_for_uring(ring);
+  if (ring->lens[slot] == 0) return NULL;
+  *len          = ring->lens[slot];
+  ring->is_held = 1;
+  return ring->buffers[slot];
+}
+
+static void uring_hand_off(Ring *ring) {
+  Uring *uring = ring->uring;
+  int    slot  = ring->caller_slot;
+  uring->offsets[slot]  = uring->next_offset;
+  uring->num_done[slot] = 0;
+  uring->next_offset   += ring->caller_len;
+  ring->lens[slot]      = ring->caller_len;
+  queue_io(ring, slot);
+  if (!enter_uring(uring, 0)) ring->was_error = 1;
+  ring->caller_slot = (slot + 1) % num_buffers;
+  ring->caller_len  = 0;
+  while (uring->is_pending[ring->caller_slot]) wait_for_uring(ring);
+}
+
+// This finishes any writes and waits for any reads in flight. It returns 0 if
+// the buffers can't be freed.
+static int stop_uring(Ring *ring) {
+  Uring *uring = ring->uring;
+  if (ring->is_writing && ring->caller_len) uring_hand_off(ring);
+  while (uring->num_pending) wait_for_uring(ring);
+
+  // Like write(), this leaves the file's offset after the bytes written.
+  if (ring->is_writing &&
+      lseek(ring->fd, uring->next_offset, SEEK_SET) == -1) {
+    ring->was_error = 1;
+  }
+  int can_free_buffers = !uring->is_stuck;
+  delete_uring(uring);
+  return can_free_buffers;
+}
+
+#else
+
+static int   start_uring(Ring *ring)                  { return 0; }
+static char *uring_read_chunk(Ring *ring, size_t *len) { return NULL; }
+static void  uring_hand_off(Ring *ring)               {}
+static int   stop_uring(Ring *ring)                   { return 1; }
+
+#endif  // has_uring
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// The functions from here down to the public ones expect ring->lock to be
+// held; the ones that do I/O let go of it meanwhile.
+
+static int has_io_to_do(Ring *ring) {
+  if (ring->is_writing) return ring->num_full > 0;
+  return !ring->is_done && ring->num_full < num_buffers;
+}
+
+static void read_one_buffer(Ring *ring) {
+  int slot = (ring->first_full + ring->num_full) % num_buffers;
+  pthread_mutex_unlock(&ring->lock);
+  trace__begin("read buffer");
+  ssize_t len;
+  do {
+    len = read(ring->fd, ring->buffers[slot], io__buffer_size);
+  } while (len == -1 && errno == EINTR);
+  trace__end();
+  pthread_mutex_lock(&ring->lock);
+  if (len > 0) {
+    ring->lens[slot] = len;
+    ring->num_full++;
+  } else {
+    ring->is_done   = 1;
+    ring->was_error = (len == -1);
+  }
+  pthread_cond_broadcast(&ring->did_change);
+}
+
+static void write_one_buffer(Ring *ring) {
+  int   slot   = ring->first_full;
+  char *cursor = ring->buffers[slot];
+  char *end    = cursor + ring->lens[slot];
+  pthread_mutex_unlock(&ring->lock);
+  trace__begin("write buffer");
+  int was_error = 0;
+  while (cursor < end) {
+    ssize_t len = write(ring->fd, cursor, end - cursor);
+    if (len == -1 && errno == EINTR) continue;
+    if (len <= 0) {
+      was_error = 1;
+      break;
+    }
+    cursor += len;
+  }
+  trace__end();
+  pthread_mutex_lock(&ring->lock);
+  if (was_error) ring->was_error = 1;
+  ring->first_full = (slot + 1) % num_buffers;
+  ring->num_full--;
+  pthread_cond_broadcast(&ring->did_change);
+}
+
+static void do_io(Ring *ring) {
+  if (ring->is_writing) write_one_buffer(ring);
+  else                  read_one_buffer(ring);
+}
+
+// The caller uses this to wait for the I/O thread to make progress. Without a
+// thread, the caller does the next read or write itself.
+static void wait_for_io(Ring *ring) {
+  if (ring->is_threaded) pthread_cond_wait(&ring->did_change, &ring->lock);
+  else                   do_io(ring);
+}
+
+// This is the body of the I/O thread.
+static void *run_io(void *ring_vp) {
+  Ring *ring = (Ring *)ring_vp;
+  trace__name_thread("io");
+  pthread_mutex_lock(&ring->lock);
+  while (1) {
+    if (has_io_to_do(ring)) {
+      do_io(ring);
+    } else if (ring->is_done) {
+      break;
+    } else {
+      pthread_cond_wait(&ring->did_change, &ring->lock);
+    }
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return NULL;
+}
+
+static Ring *new_ring(int fd, int is_writing) {
+  Ring *ring = calloc(1, sizeof(Ring));
+  ring->fd         = fd;
+  ring->is_writing = is_writing;
+  for (int i = 0; i < num_buffers; ++i) {
+    ring->buffers[i] = malloc(io__buffer_size);
+  }
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->did_change, NULL);
+  if (!start_uring(ring)) {
+    ring->is_threaded =
+        (pthread_create(&ring->thread, NULL, run_io, ring) == 0);
+  }
+  return ring;
+}
+
+// This passes the caller's buffer to the I/O thread and waits for a free one.
+static void hand_off(Ring *ring) {
+  if (ring->uring) {
+    uring_hand_off(ring);
+    return;
+  }
+  ring->lens[ring->caller_slot] = ring->caller_len;
+  ring->num_full++;
+  pthread_cond_broadcast(&ring->did_change);
+  while (ring->num_full == num_buffers) wait_for_io(ring);
+  ring->caller_slot = (ring->caller_slot + 1) % num_buffers;
+  ring->caller_len  = 0;
+}
+
+// This sets up `replacement` to write over `path` itself, with no temporary
+// file. It returns 0 and sets errno if `path` can't be opened.
+static int open_in_place(io__Replacement *replacement, char *path) {
+  replacement->temp_path[0] = '\0';
+  replacement->file         = fopen(path, "wb");
+  return replacement->file != NULL;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void io__disable_uring() {
+  is_uring_enabled = 0;
+}
+
+io__File io__start_reading(int fd) {
+  return new_ring(fd, 0);  // 0 = not writing
+}
+
+char *io__read_chunk(io__File ring, size_t *len) {
+  if (ring->uring) return uring_read_chunk(ring, len);
+  pthread_mutex_lock(&ring->lock);
+  if (ring->is_held) {
+    ring->first_full = (ring->first_full + 1) % num_buffers;
+    ring->num_full--;
+    ring->is_held = 0;
+    pthread_cond_broadcast(&ring->did_change);
+  }
+  while (ring->num_full == 0 && !ring->is_done) wait_for_io(ring);
+  char *chunk = NULL;
+  if (ring->num_full) {
+    chunk         = ring->buffers[ring->first_full];
+    *len          = ring->lens[ring->first_full];
+    ring->is_held = 1;
+  }
+  pthread_mutex_unlock(&ring->lock);
+  return chunk;
+}
+
+io__File io__start_writing(int fd) {
+  return new_ring(fd, 1);  // 1 = writing
+}
+
+void io__write(io__File ring, const char *bytes, size_t len) {
+  while (len) {
+    size_t space = io__buffer_size - ring->caller_len;
+    size_t n     = len < space ? len : space;
+    memcpy(ring->buffers[ring->caller_slot] + ring->caller_len, bytes, n);
+    ring->caller_len += n;
+    bytes            += n;
+    len              -= n;
+    if (ring->caller_len == io__buffer_size) {
+      pthread_mutex_lock(&ring->lock);
+      hand_off(ring);
+      pthread_mutex_unlock(&ring->lock);
+    }
+  }
+}
+
+int io__stop(io__File ring) {
+  int can_free_buffers = 1;
+  if (ring->uring) {
+    can_free_buffers = stop_uring(ring);
+  } else {
+    pthread_mutex_lock(&ring->lock);
+    if (ring->is_writing) {
+      if (ring->caller_len) hand_off(ring);
+      while (ring->num_full) wait_for_io(ring);
+    }
+    ring->is_done = 1;
+    pthread_cond_broadcast(&ring->did_change);
+    pthread_mutex_unlock(&ring->lock);
+    if (ring->is_threaded) pthread_join(ring->thread, NULL);
+  }
+
+  int was_error = ring->was_error;
+  if (can_free_buffers) {
+    for (int i = 0; i < num_buffers; ++i) free(ring->buffers[i]);
+  }
+  pthread_mutex_destroy(&ring->lock);
+  pthread_cond_destroy(&ring->did_change);
+  free(ring);
+  return !was_error;
+}
+
+int io__start_replacement(io__Replacement *replacement, char *path) {
+  struct stat file_stats;
+  int does_exist = (stat(path, &file_stats) == 0);
+
+  // Replacing a special file or one with other hard links would change what it
+  // is, so those are written in place.
+  if (does_exist &&
+      (!S_ISREG(file_stats.st_mode) || file_stats.st_nlink != 1)) {
+    return open_in_place(replacement, path);
+  }
+  if (does_exist && access(path, W_OK) != 0) return 0;
+
+  // Links are followed, so that it's the file they point to that's replaced.
+  if (!does_exist || realpath(path, replacement->path) == NULL) {
+    if (strlen(path) >= PATH_MAX) {
+      errno = ENAMETOOLONG;
+      return 0;
+    }
+    strcpy(replacement->path, path);
+  }
+  char *name     = strrchr(replacement->path, '/');
+  name           = name ? name + 1 : replacement->path;
+  int   dir_len  = (int)(name - replacement->path);
+  int   path_len = snprintf(replacement->temp_path, PATH_MAX, "%.*s.%s.XXXXXX",
+                            dir_len, replacement->path, name);
+  if (path_len >= PATH_MAX) {
+    errno = ENAMETOOLONG;
+    return 0;
+  }
+
+  // The file is written in place if the directory isn't writable or the
+  // temporary file can't be given the file's owner.
+  int fd = mkstemp(replacement->temp_path);
+  if (fd == -1) return open_in_place(replacement, path);
+  if (does_exist &&
+      fchown(fd, file_stats.st_uid, file_stats.st_gid) != 0) {
+    close(fd);
+    unlink(replacement->temp_path);
+    return open_in_place(replacement, path);
+  }
+
+  // mkstemp makes the file readable only by its owner.
+  mode_t mode;
+  if (does_exist) {
+    mode = file_stats.st_mode & 07777;
+  } else {
+    mode_t mask = umask(0);
+    umask(mask);
+    mode = 0666 & ~mask;
+  }
+  replacement->file = fchmod(fd, mode) == 0 ? fdopen(fd, "wb") : NULL;
+  if (replacement->file == NULL) {
+    int saved_errno = errno;
+    close(fd);
+    unlink(replacement->temp_path);
+    errno = saved_errno;
+    return 0;
+  }
+  return 1;
+}
+
+int io__end_replacement(io__Replacement *replacement, int do_keep) {
+  if (replacement->temp_path[0] == '\0') return 1;  // It was written in place.
+  if (do_keep && rename(replacement->temp_path, replacement->path) == 0) {
+    return 1;
+  }
+  unlink(replacement->temp_path);
+  return !do_keep;
+}
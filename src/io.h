@@ -0,0 +1,76 @@
+// io.h
+//
+// Reading and writing files in large chunks in the background.
+//
+// Each open file has a ring of io__buffer_size buffers that pass between the
+// caller and the kernel. When reading, buffers are filled ahead of the caller,
+// so the disk stays busy while the caller splits earlier chunks into lines;
+// when writing, the caller fills buffers while the earlier ones are written
+// out. On Linux, the reads and writes are submitted with io_uring, several at
+// a time; elsewhere, or where the kernel refuses io_uring, an I/O thread does
+// them one at a time.
+//
+// A regular file with no other hard links is saved by way of a replacement: a
+// temporary file in the same directory, with the file's owner and mode, that's
+// renamed over the file only once it's been written in full, so an interrupted
+// or failed save leaves the old file as it was. Other files, such as FIFOs,
+// devices and hard-linked files, and files whose directory isn't writable or
+// whose owner can't be kept, are written in place as before; an interrupted
+// save can then leave them with only part of the buffer.
+//
+
+#pragma once
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types and constants.
+
+#define io__buffer_size (1 << 20)
+
+typedef struct io__Ring *io__File;
+
+typedef struct {
+  FILE *file;                 // This is open for writing the temporary file.
+  char  path[PATH_MAX];       // The file to replace, with links resolved.
+  char  temp_path[PATH_MAX];  // This is empty when writing in place.
+} io__Replacement;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// After this is called, files use an I/O thread even where io_uring works.
+void     io__disable_uring();
+
+// This starts reading the open file descriptor `fd` from its current offset.
+io__File io__start_reading(int fd);
+
+// This returns the next chunk of the file, setting *len to its length, or NULL
+// at the end of the file. The caller may change the chunk's bytes; it stays
+// valid until the next call.
+char *   io__read_chunk(io__File file, size_t *len);
+
+// This starts writing to the open file descriptor `fd`.
+io__File io__start_writing(int fd);
+
+// This appends `len` bytes to the file.
+void     io__write(io__File file, const char *bytes, size_t len);
+
+// This finishes any writes, stops any I/O thread and frees `file`, without
+// closing its descriptor. It returns 0 if a read or write failed and 1
+// otherwise.
+int      io__stop(io__File file);
+
+// This opens a temporary file to replace `path`, giving it the owner and
+// permissions of `path` if that exists, or opens `path` itself when it can't be
+// replaced safely. It returns 0 and sets errno if `path` can't be written.
+int      io__start_replacement(io__Replacement *replacement, char *path);
+
+// Once replacement->file is closed, this renames any temporary file over the
+// original if do_keep is set, and otherwise removes it. It returns 0 if the
+// rename fails, leaving the original as it was.
+int      io__end_replacement(io__Replacement *replacement, int do_keep);
@@ -0,0 +1,179 @@
+// matcher.c
+//
+
+// Header for this file.
+#include "matcher.h"
+
+// Local includes.
+#include "ed2.h"
+#include "stats.h"
+
+// Standard includes.
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static unsigned char fold(unsigned char c) {
+  return ('A' <= c && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// This is 0x20 for ASCII letters and 0 otherwise. Setting this bit of a letter
+// gives its lowercase form.
+static unsigned char case_bit(unsigned char c) {
+  return ('a' <= fold(c) && fold(c) <= 'z') ? 0x20 : 0;
+}
+
+// Each byte of the result is 0x80 where `word` has a zero byte, and 0
+// elsewhere.
+static uint64_t zero_bytes(uint64_t word) {
+  uint64_t low7 = 0x7f7f7f7f7f7f7f7full;
+  return ~(((word & low7) + low7) | word | low7);
+}
+
+static int does_match_at(char *p, char *needle, size_t needle_len) {
+  for (size_t i = 0; i < needle_len; ++i) {
+    if (fold(p[i]) != fold(needle[i])) return 0;
+  }
+  return 1;
+}
+
+// Candidate positions are found 8 at a time by loading the words starting at
+// p and p + 1 and checking them against the first two bytes of the needle in
+// either case; the needle is only compared in full at candidates.
+static char *find_icase(char *haystack, size_t haystack_len,
+                        char *needle, size_t needle_len) {
+  if (needle_len == 0) return haystack;
+  if (needle_len > haystack_len) return NULL;
+
+  uint64_t ones   = 0x0101010101010101ull;
+  uint64_t case1  = ones * case_bit(needle[0]);
+  uint64_t want1  = ones * fold(needle[0]);
+  // A one-byte needle puts no condition on the second byte.
+  uint64_t case2  = needle_len > 1 ? ones * case_bit(needle[1]) : ~0ull;
+  uint64_t want2  = needle_len > 1 ? ones * fold(needle[1])     : ~0ull;
+
+  // `end` is one past the last possible start. The word at p + 1 reaches one
+  // byte further than the needle can, which is past the end of the haystack
+  // for a one-byte needle.
+  char *end       = haystack + haystack_len - needle_len + 1;
+  char *words_end = end - (needle_len == 1);
+  char *p         = haystack;
+  for (; p + 8 <= words_end; p += 8) {
+    uint64_t word1, word2;
+    memcpy(&word1, p,     8);  // These are unaligned loads.
+    memcpy(&word2, p + 1, 8);
+    if ((zero_bytes((word1 | case1) ^ want1) &
+         zero_bytes((word2 | case2) ^ want2)) == 0) continue;
+    for (int i = 0; i < 8; ++i) {
+      if (does_match_at(p + i, needle, needle_len)) return p + i;
+    }
+  }
+  for (; p < end; ++p) {
+    if (does_match_at(p, needle, needle_len)) return p;
+  }
+  return NULL;
+}
+
+// This is matcher__exec without the counting for stats.
+static int exec(matcher__Matcher *matcher, char *string,
+                size_t nmatch, regmatch_t *matches, int exec_flags) {
+  if (matcher->literal == NULL) {
+    return regexec(&matcher->compiled_re, string, nmatch, matches, exec_flags);
+  }
+  int   is_icase = matcher->flags & matcher__ignore_case;
+  char *found;
+  if (exec_flags & REG_STARTEND) {
+    char  *start = string + matches[0].rm_so;
+    size_t len   = matches[0].rm_eo - matches[0].rm_so;
+    if (is_icase) {
+      found = find_icase(start, len, matcher->literal, matcher->literal_len);
+    } else {
+      found = memmem(start, len, matcher->literal, matcher->literal_len);
+    }
+  } else {
+    found = matcher__find_fixed(string, matcher->literal,
+                                matcher->literal_len, is_icase);
+  }
+  if (found == NULL) return REG_NOMATCH;
+  for (size_t i = 0; i < nmatch; ++i) {
+    matches[i].rm_so = matches[i].rm_eo = -1;
+  }
+  if (nmatch > 0) {
+    matches[0].rm_so = found - string;
+    matches[0].rm_eo = matches[0].rm_so + matcher->literal_len;
+  }
+  return 0;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void matcher__parse_flags(char **cursor, int *flags) {
+  for (;; ++*cursor) {
+    if      (**cursor == 'I') *flags |= matcher__ignore_case;
+    else if (**cursor == 'L') *flags |= matcher__literal;
+    else    return;
+  }
+}
+
+int matcher__compile(matcher__Matcher *matcher, char *pattern, int flags,
+                     char *err_str) {
+  matcher->flags   = flags;
+  matcher->literal = NULL;
+  if (flags & matcher__literal) {
+    matcher->literal     = strdup(pattern);
+    matcher->literal_len = strlen(pattern);
+    return 0;
+  }
+
+  int compile_flags = REG_EXTENDED;
+  if (flags & matcher__ignore_case) compile_flags |= REG_ICASE;
+  int err_code = regcomp(&matcher->compiled_re, pattern, compile_flags);
+  if (err_code) {
+    regerror(err_code, &matcher->compiled_re, err_str, string_capacity);
+  }
+  return err_code;
+}
+
+int matcher__exec(matcher__Matcher *matcher, char *string,
+                  size_t nmatch, regmatch_t *matches, int exec_flags) {
+  if (!stats__is_on) return exec(matcher, string, nmatch, matches, exec_flags);
+  double start  = stats__now();
+  int    result = exec(matcher, string, nmatch, matches, exec_flags);
+  stats__command.num_matches   += 1;
+  stats__command.match_seconds += stats__now() - start;
+  return result;
+}
+
+void matcher__error(matcher__Matcher *matcher, int err_code, char *err_str) {
+  regerror(err_code, &matcher->compiled_re, err_str, string_capacity);
+}
+
+void matcher__free(matcher__Matcher *matcher) {
+  if (matcher->flags & matcher__literal) {
+    free(matcher->literal);
+    matcher->literal = NULL;
+  } else {
+    // The man page at regex(3) doesn't make it clear if we should call regfree
+    // when regcomp has an error. However, looking at the source:
+    // http://www.opensource.apple.com/source/gcc/gcc-5659/libiberty/regex.c
+    // it's clear that calling regfree here is at very least safe, and in my
+    // estimation is the right thing to do.
+    regfree(&matcher->compiled_re);
+  }
+}
+
+char *matcher__find_fixed(char *haystack, char *needle, size_t needle_len,
+                          int is_icase) {
+  if (!is_icase) return strstr(haystack, needle);
+  return find_icase(haystack, strlen(haystack), needle, needle_len);
+}
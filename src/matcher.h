@@ -0,0 +1,63 @@
+// matcher.h
+//
+// Functions to find a pattern in a line, either as an extended regular
+// expression or as a fixed string, optionally ignoring case.
+//
+// The interface follows regcomp/regexec so callers can use either kind. Fixed
+// strings skip the regex engine entirely: case-sensitive ones use the C
+// library's strstr, and case-insensitive ones look for the first two bytes of
+// the pattern, in either case, 8 positions at a time before comparing the rest.
+//
+
+#pragma once
+
+#include <regex.h>
+#include <stddef.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types and constants.
+
+// These flags may be or'd together.
+#define matcher__literal     1  // The pattern is a fixed string.
+#define matcher__ignore_case 2
+
+typedef struct {
+  int     flags;
+  regex_t compiled_re;  // This is used unless flags has matcher__literal.
+  char *  literal;      // The fixed string, if flags has matcher__literal.
+  size_t  literal_len;
+} matcher__Matcher;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This reads any `I` and `L` flag letters at *cursor into *flags, advancing
+// *cursor past them.
+void   matcher__parse_flags(char **cursor, int *flags);
+
+// This returns 0 on success, or else fills err_str, which has room for
+// string_capacity bytes, with a message and returns a regcomp error code.
+// Either way, the matcher must be released with matcher__free.
+int    matcher__compile(matcher__Matcher *matcher, char *pattern, int flags,
+                        char *err_str);
+
+// This works like regexec, returning 0 on a match and REG_NOMATCH otherwise,
+// or another regexec error code. A fixed string fills in only matches[0] and
+// marks any other matches as unused. With REG_STARTEND in exec_flags, only the
+// bytes delimited by matches[0] are searched, so repeated searches through a
+// long string don't each have to find its end.
+int    matcher__exec(matcher__Matcher *matcher, char *string,
+                     size_t nmatch, regmatch_t *matches, int exec_flags);
+
+// This fills err_str, which has room for string_capacity bytes, with a
+// message for an error code returned by matcher__exec.
+void   matcher__error(matcher__Matcher *matcher, int err_code, char *err_str);
+
+void   matcher__free(matcher__Matcher *matcher);
+
+// This returns the first occurrence of `needle` in `haystack`, or NULL if
+// there is none. If is_icase is true, ASCII letters match either case.
+char * matcher__find_fixed(char *haystack, char *needle, size_t needle_len,
+                           int is_icase);
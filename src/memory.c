@@ -0,0 +1,80 @@
+// memory.c
+//
+
+// Header for this file.
+#include "memory.h"
+
+// Standard includes.
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#define held_size(block) malloc_size(block)
+#elif defined(__GLIBC__)
+#include <malloc.h>
+#define held_size(block) malloc_usable_size(block)
+#else
+#define held_size(block) 0
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// This adds a block of which `used` bytes are in use and `allocated` bytes
+// were asked for.
+static void add_items(memory__Usage *usage, void *items, int64_t used,
+                      int64_t allocated) {
+  if (items == NULL) return;
+  int64_t held = held_size(items);
+  usage->num_blocks += 1;
+  usage->used_bytes += used;
+  usage->held_bytes += held > allocated ? held : allocated;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void memory__add_block(memory__Usage *usage, void *block, size_t used_bytes) {
+  add_items(usage, block, used_bytes, used_bytes);
+}
+
+void memory__add_string(memory__Usage *usage, char *string) {
+  memory__add_block(usage, string, strlen(string) + 1);
+}
+
+void memory__add_array(memory__Usage *usage, Array array) {
+  if (array == NULL) return;
+  memory__add_block(usage, array, sizeof(ArrayStruct));
+  add_items(usage, array->items, array->count * array->item_size,
+            array->capacity * array->item_size);
+}
+
+void memory__add_map(memory__Usage *usage, Map map) {
+  if (map == NULL) return;
+  Array slots = map->slots;
+  memory__add_block(usage, map, sizeof(MapStruct));
+  memory__add_block(usage, slots, sizeof(ArrayStruct));
+  add_items(usage, slots->items, map->count * slots->item_size,
+            slots->capacity * slots->item_size);
+}
+
+void memory__print_report(memory__Row *rows, int num_rows) {
+  printf("%-18s %10s %14s %14s %14s\n",
+         "structure", "blocks", "used bytes", "held bytes", "slack bytes");
+  memory__Row total = { .name = "total" };
+  for (int i = 0; i <= num_rows; ++i) {
+    memory__Row *row = (i < num_rows) ? &rows[i] : &total;
+    printf("%-18s %10" PRId64 " %14" PRId64 " %14" PRId64 " %14" PRId64 "\n",
+           row->name, row->usage.num_blocks, row->usage.used_bytes,
+           row->usage.held_bytes,
+           row->usage.held_bytes - row->usage.used_bytes);
+    if (i == num_rows) break;
+    total.usage.num_blocks += row->usage.num_blocks;
+    total.usage.used_bytes += row->usage.used_bytes;
+    total.usage.held_bytes += row->usage.held_bytes;
+  }
+}
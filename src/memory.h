@@ -0,0 +1,56 @@
+// memory.h
+//
+// Accounting for the memory used by the buffer and its side structures.
+//
+// The M command prints a row for each structure: the line text, the `lines`
+// table, the undo backup's table and text, the global command's match set and
+// cached results, and the trigram index, cold blocks and shared-line table when
+// their options are on. Each row gives the number of blocks, the bytes in use,
+// the bytes the allocator set aside for them, and the slack between the two:
+// unused array capacity plus allocator rounding. Set-aside sizes come from
+// malloc_usable_size, or malloc_size on macOS; elsewhere they're the sizes
+// asked for.
+//
+// Modules add their own structures to a memory__Usage, so that the report
+// needn't know how they're laid out; ed2.c gathers the rows.
+//
+
+#pragma once
+
+#include "cstructs/cstructs.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+typedef struct {
+  int64_t num_blocks;
+  int64_t used_bytes;  // This is what the structure needs.
+  int64_t held_bytes;  // This is what the allocator gave it.
+} memory__Usage;
+
+typedef struct {
+  char *        name;
+  memory__Usage usage;
+} memory__Row;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This adds a block from malloc of which `used_bytes` are in use.
+void memory__add_block(memory__Usage *usage, void *block, size_t used_bytes);
+
+// This adds a null-terminated string from malloc.
+void memory__add_string(memory__Usage *usage, char *string);
+
+// These add an Array or Map and their items, counting unused capacity and
+// empty slots as slack. The items' own pointees aren't included.
+void memory__add_array(memory__Usage *usage, Array array);
+void memory__add_map(memory__Usage *usage, Map map);
+
+// This prints `rows` as a table, followed by their total.
+void memory__print_report(memory__Row *rows, int num_rows);
@@ -0,0 +1,112 @@
+// progress.c
+//
+
+// Header for this file.
+#include "progress.h"
+
+// Standard includes.
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants.
+
+// The clock is read once per this many polls.
+#define polls_per_check    256
+
+#define seconds_per_report 0.25
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+static volatile sig_atomic_t is_interrupted = 0;
+
+static double       show_after  = -1;  // This is -1 when progress is hidden.
+static double       command_start;
+static double       last_report = 0;
+static int          did_report  = 0;
+
+// Only the outermost loop, at depth 1, reports its progress.
+static int          loop_depth  = 0;
+static const char * loop_what;
+static int64_t      loop_total;
+static int64_t      num_polls   = 0;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static void handle_sigint(int signum) {
+  is_interrupted = 1;
+}
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(int64_t done) {
+  double t = now();
+  if (t - command_start < show_after || t - last_report < seconds_per_report) {
+    return;
+  }
+  last_report = t;
+  did_report  = 1;
+  fprintf(stderr, "\r%s: %" PRId64 " of %" PRId64 " (%d%%)", loop_what, done,
+          loop_total, loop_total ? (int)(100 * done / loop_total) : 100);
+  fflush(stderr);
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void progress__init() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handle_sigint;
+  action.sa_flags   = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+}
+
+void progress__show_after(double seconds) {
+  show_after = seconds;
+}
+
+void progress__start_command() {
+  is_interrupted = 0;  // An interrupt while waiting for input is dropped.
+  command_start  = now();
+  loop_depth     = 0;
+  did_report     = 0;
+}
+
+int progress__end_command() {
+  if (did_report) fprintf(stderr, "\r\033[K");  // This clears the line.
+  return is_interrupted;
+}
+
+void progress__start_loop(const char *what, int64_t total) {
+  if (loop_depth++ > 0) return;
+  loop_what  = what;
+  loop_total = total;
+}
+
+void progress__end_loop() {
+  loop_depth--;
+}
+
+int progress__should_stop(int64_t done) {
+  if (is_interrupted) return 1;
+  if (show_after >= 0 && loop_depth == 1 &&
+      ++num_polls % polls_per_check == 0) {
+    report(done);
+  }
+  return 0;
+}
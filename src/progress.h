@@ -0,0 +1,41 @@
+// progress.h
+//
+// Interrupting long commands, and reporting on their progress.
+//
+// A SIGINT, as from ctrl-C, only sets a flag. The loops of s, g, v, d and w
+// poll it at points where the buffer is consistent and stop early; the command
+// then reports error__interrupted, and the main loop puts the buffer back as
+// it was before the command, from the undo backup the command saved.
+//
+// With the -p option, a loop that has run longer than the given number of
+// seconds also shows how far it's got on stderr, rewriting one line in place.
+// Loops inside other loops, such as an s run by g for each line, don't report
+// their own progress.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This installs the SIGINT handler.
+void progress__init();
+
+// This shows the progress of loops that run longer than `seconds`.
+void progress__show_after(double seconds);
+
+// These bracket each command. The end returns 1 iff the command was
+// interrupted, and clears the progress line if one was shown.
+void progress__start_command();
+int  progress__end_command();
+
+// These bracket a loop over `total` items, called `what` in the progress line.
+void progress__start_loop(const char *what, int64_t total);
+void progress__end_loop();
+
+// This returns 1 iff the running command should stop. Within a loop, it may
+// show how many of the loop's items are `done`.
+int  progress__should_stop(int64_t done);
@@ -0,0 +1,99 @@
+// record.c
+//
+
+// Header for this file.
+#include "record.h"
+
+// Library includes.
+#include <readline/readline.h>
+
+// Standard includes.
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants.
+
+#define fnv_offset_basis 14695981039346656037ull
+#define fnv_prime        1099511628211ull
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// This is NULL unless a session is being recorded.
+static FILE *   file = NULL;
+
+// These time the running command; waiting is the time spent in readline.
+static int64_t  command_start;
+static int64_t  waiting;
+static int      is_command_running = 0;
+
+// This is the FNV-1a hash of the bytes of the file being loaded.
+static uint64_t file_hash = fnv_offset_basis;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static int64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+int record__start(char *path, char **options, int num_options) {
+  file = fopen(path, "w");
+  if (file == NULL) return 0;
+  // Each entry is flushed as it's written, so a crash loses nothing.
+  setvbuf(file, NULL, _IOLBF, 0);
+  fprintf(file, "ed2 recording 1\no");
+  for (int i = 0; i < num_options; ++i) fprintf(file, " %s", options[i]);
+  fprintf(file, "\n");
+  return 1;
+}
+
+void record__command(char *line) {
+  if (file == NULL || line == NULL) return;
+  fprintf(file, "c %s\n", line);
+  command_start      = now_us();
+  waiting            = 0;
+  is_command_running = 1;
+}
+
+char *record__read_input() {
+  if (file == NULL) return readline("");
+  int64_t start = now_us();
+  char *  line  = readline("");  // The caller owns the memory of `line`.
+  waiting += now_us() - start;
+  if (line) fprintf(file, "i %s\n", line);
+  return line;
+}
+
+void record__end_command() {
+  if (file == NULL || !is_command_running) return;
+  fprintf(file, "t %" PRId64 "\n", now_us() - command_start - waiting);
+  is_command_running = 0;
+}
+
+void record__add_file_bytes(const char *bytes, size_t len) {
+  if (file == NULL) return;
+  uint64_t h = file_hash;
+  for (size_t i = 0; i < len; ++i) {
+    h = (h ^ (unsigned char)bytes[i]) * fnv_prime;
+  }
+  file_hash = h;
+}
+
+void record__loaded_file(char *name, int64_t size) {
+  if (file == NULL) return;
+  fprintf(file, "f %016" PRIx64 " %" PRId64 " %s\n", file_hash, size, name);
+  file_hash = fnv_offset_basis;  // Start over for the next file.
+}
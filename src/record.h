@@ -0,0 +1,46 @@
+// record.h
+//
+// Optional recording of a session.
+//
+// With the -r option, every line of input is written to a recording file as
+// it's read, so a slow session can be replayed later with bench/replay.c. The
+// file is text, one entry per line:
+//
+//   ed2 recording 1
+//   o <the other options ed2 was started with>
+//   f <FNV-1a hash of a loaded file, in hex> <its size in bytes> <its name>
+//   c <a command line>
+//   i <a line read while a command ran: input-mode text or a g continuation>
+//   t <the microseconds the command took, without waiting for input>
+//
+// Each command's i and f entries follow its c entry and come before its t
+// entry. A command that ends the session has no t entry.
+//
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This starts recording to `path`, noting the `num_options` options that
+// ed2 was started with. It returns 0 if the file can't be written.
+int    record__start(char *path, char **options, int num_options);
+
+// This notes that `line` was read as a command and starts timing it.
+void   record__command(char *line);
+
+// This reads a line of input for the running command with readline, noting it
+// and leaving the wait out of the command's time.
+char * record__read_input();
+
+// This notes the time taken by the command since record__command.
+void   record__end_command();
+
+// These note a file as it's loaded: its bytes as they're read, and then its
+// name and size once it's loaded.
+void   record__add_file_bytes(const char *bytes, size_t len);
+void   record__loaded_file(char *name, int64_t size);
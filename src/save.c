@@ -0,0 +1,120 @@
+// save.c
+//
+
+// Header for this file.
+#include "save.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+#include "ed2.h"
+#include "io.h"
+#include "trace.h"
+#include "trigram.h"
+
+// Standard includes.
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// These are NULL unless a save is running. The snapshot has the items of the
+// editor's lines as they were when the save started; held_lines has the lines
+// freed since then that aren't cold.
+static Array     snapshot   = NULL;
+static Array     held_lines = NULL;
+
+static io__Replacement replacement;
+
+// These are set by the writer thread before it sets is_done.
+static int64_t   nbytes_written;
+static int       was_error;
+
+static pthread_t writer;
+static int       is_threaded;  // This is 0 if the writer couldn't be started.
+static int       is_done;
+static pthread_mutex_t done_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// This is the body of the writer thread. It writes the lines as save_file in
+// ed2.c does.
+static void *write_snapshot(void *unused) {
+  trace__name_thread("save");
+  trace__begin("background save");
+  cold__Reader reader = { .id = -1 };
+  io__File     out    = io__start_writing(fileno(replacement.file));
+  nbytes_written = 0;
+  array__typed_for(line_array, item, snapshot, i) {
+    char *line = *item;
+    if (cold__is_cold(line)) line = cold__read_text(&reader, line);
+    size_t len = strlen(line);
+    if (i) io__write(out, "\n", 1);
+    io__write(out, line, len);
+    nbytes_written += len + (i ? 1 : 0);
+  }
+  cold__free_reader(&reader);
+  was_error = !io__stop(out);
+  if (fclose(replacement.file) != 0) was_error = 1;
+  trace__end();
+
+  pthread_mutex_lock(&done_lock);
+  is_done = 1;
+  pthread_mutex_unlock(&done_lock);
+  return NULL;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void save__start(ed2__Editor *ed, io__Replacement *new_replacement) {
+  snapshot = array__new(64, sizeof(char *));
+  array__add_zeroed_items(snapshot, ed->lines->count);
+  for (int64_t i = 0; i < ed->lines->count; ++i) {
+    *line_array__item_ptr(snapshot, i) = line_id_at_index(ed, i);
+  }
+  cold__retain_lines(snapshot);
+  held_lines = array__new(64, sizeof(char *));
+
+  replacement = *new_replacement;
+  is_done     = 0;
+  is_threaded = (pthread_create(&writer, NULL, write_snapshot, NULL) == 0);
+  if (!is_threaded) write_snapshot(NULL);
+}
+
+int save__hold_line(char *line) {
+  if (snapshot == NULL) return 0;
+  array__new_val(held_lines, char *) = line;
+  return 1;
+}
+
+int save__end(ed2__Editor *ed, int do_wait) {
+  if (snapshot == NULL) return 0;
+  if (!do_wait) {
+    pthread_mutex_lock(&done_lock);
+    int is_finished = is_done;
+    pthread_mutex_unlock(&done_lock);
+    if (!is_finished) return 0;
+  }
+  if (is_threaded) pthread_join(writer, NULL);
+  if (!io__end_replacement(&replacement, !was_error)) was_error = 1;
+
+  cold__release_lines(snapshot);
+  array__delete(snapshot);
+  snapshot = NULL;
+  array__for(char **, line, held_lines, i) trigram__free_line(*line);
+  array__delete(held_lines);
+  held_lines = NULL;
+
+  if (was_error) {
+    ed2__error(ed, error__bad_write);
+    return -1;
+  }
+  printf("%" PRId64 "\n", nbytes_written);  // Report how many bytes we wrote.
+  return 1;
+}
@@ -0,0 +1,37 @@
+// save.h
+//
+// Optional saving on a background thread.
+//
+// With the -b option, the w command takes a snapshot of the items of `lines`
+// and hands it to a writer thread, so that editing can go on while a large
+// buffer is written. Lines are never changed in place, so the snapshot only
+// needs the strings it points to to stay alive: lines freed while the save
+// runs are held until it ends, and cold lines keep their blocks alive through
+// the snapshot's handles. The result is reported after the save ends.
+//
+
+#pragma once
+
+#include "ed2.h"
+#include "io.h"
+
+#include <stdio.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This starts writing the current lines of `ed` to replacement->file, which it
+// closes when done; the file is put in place when the save ends. It expects
+// that no other save is running.
+void save__start(ed2__Editor *ed, io__Replacement *replacement);
+
+// If a save is running, this holds `line`, which is no longer in `lines`, and
+// returns 1; the line is freed when the save ends. Otherwise it returns 0.
+int  save__hold_line(char *line);
+
+// This ends a save that has finished, or with do_wait, any running save,
+// reporting to `ed` how many bytes it wrote or that it failed. It returns -1 if
+// a save failed, 1 if one succeeded and 0 if none ended. It's expected to be
+// called with the trigram lock held.
+int  save__end(ed2__Editor *ed, int do_wait);
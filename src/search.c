@@ -0,0 +1,227 @@
+// search.c
+//
+
+// Header for this file.
+#include "search.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+#include "ed2.h"
+#include "matcher.h"
+#include "stats.h"
+
+// Standard includes.
+#include <ctype.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+// This is used for searches with an empty pattern, as in `//`.
+static char *last_pattern = NULL;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// Returns a pointer to the character just after the bracket expression that
+// starts at `open`, which is expected to point to a '['.
+static char *skip_bracket_expression(char *open) {
+  char *cursor = open + 1;
+  if (*cursor == '^') cursor++;
+  if (*cursor == ']') cursor++;  // A leading ']' is part of the set.
+  while (*cursor && *cursor != ']') cursor++;
+  return *cursor ? cursor + 1 : cursor;
+}
+
+// Returns a pointer to the character just after the group that starts at
+// `open`, which is expected to point to a '('.
+static char *skip_group(char *open) {
+  int depth = 0;
+  for (char *cursor = open; *cursor; ++cursor) {
+    if (*cursor == '\\' && *(cursor + 1)) {
+      cursor++;
+    } else if (*cursor == '[') {
+      cursor = skip_bracket_expression(cursor) - 1;
+    } else if (*cursor == '(') {
+      depth++;
+    } else if (*cursor == ')' && --depth == 0) {
+      return cursor + 1;
+    }
+  }
+  return open + strlen(open);
+}
+
+// Returns 1 iff line_num is a match. On a regexec failure, this reports an
+// error and sets *is_err.
+static int does_line_match(ed2__Editor *ed, regex_t *compiled_re,
+                           search__Filter *filter, int64_t line_num,
+                           int *is_err) {
+  if (!search__may_match(ed, filter, line_num - 1)) return 0;
+  char *line = line_text_at_index(ed, line_num - 1);
+  double start    = stats__is_on ? stats__now() : 0;
+  int    err_code = regexec(compiled_re, line, 0, NULL, 0);  // 0, NULL = nmatch
+  if (stats__is_on) {
+    stats__command.num_matches   += 1;
+    stats__command.match_seconds += stats__now() - start;
+  }
+  if (err_code == 0) return 1;
+  if (err_code != REG_NOMATCH) {
+    char err_str[string_capacity];
+    regerror(err_code, compiled_re, err_str, string_capacity);
+    ed2__error(ed, err_str);
+    *is_err = 1;
+  }
+  return 0;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+int64_t search__find_line(ed2__Editor *ed, char *pattern, int64_t from_line,
+                          int is_backward) {
+  if (*pattern == '\0') {
+    if (last_pattern == NULL) {
+      ed2__error(ed, error__no_prev_pattern);
+      return 0;
+    }
+    pattern = last_pattern;
+  } else {
+    free(last_pattern);
+    last_pattern = strdup(pattern);
+  }
+
+  regex_t compiled_re;
+  int compile_flags = REG_EXTENDED | REG_NOSUB;
+  int err_code = regcomp(&compiled_re, pattern, compile_flags);
+  if (err_code) {
+    char err_str[string_capacity];
+    regerror(err_code, &compiled_re, err_str, string_capacity);
+    ed2__error(ed, err_str);
+    regfree(&compiled_re);  // See the comment on regfree in matcher.c.
+    return 0;
+  }
+
+  // Both directions do the same work per line, so they run at the same speed.
+  search__Filter filter;
+  search__init_filter(&filter, pattern, 0);  // 0 = matcher flags
+  int64_t num_lines = last_line(ed);
+  int64_t step      = is_backward ? -1 : 1;
+  int64_t line_num  = from_line;
+  int64_t found     = 0;
+  int     is_err    = 0;
+  for (int64_t n = 0; n < num_lines && !found && !is_err; ++n) {
+    line_num += step;
+    if (line_num > num_lines) line_num = 1;
+    if (line_num < 1)         line_num = num_lines;
+    if (does_line_match(ed, &compiled_re, &filter, line_num, &is_err)) {
+      found = line_num;
+    }
+  }
+  search__free_filter(&filter);
+  regfree(&compiled_re);
+
+  if (!found && !is_err) ed2__error(ed, error__no_match);
+  return found;
+}
+
+char *search__find_literal(char *pattern) {
+  // With alternation, no single literal is required.
+  if (strchr(pattern, '|')) return NULL;
+
+  // We look for the longest run of literal characters that can't be skipped.
+  size_t len      = strlen(pattern);
+  char * run      = calloc(len + 1, 1);
+  char * best     = calloc(len + 1, 1);
+  size_t run_len  = 0;
+  size_t best_len = 0;
+
+  char *cursor = pattern;
+  while (1) {
+    // 1. Read one token; it's either a literal character or something else.
+    char c = *cursor++;
+    int is_literal = 0;
+    if (c == '\\' && *cursor) {
+      // Escaped letters and digits are classes or backreferences.
+      is_literal = !isalnum((unsigned char)*cursor);
+      c = *cursor++;
+    } else if (c == '[') {
+      cursor = skip_bracket_expression(cursor - 1);
+    } else if (c == '(') {
+      cursor = skip_group(cursor - 1);
+    } else if (c && !strchr(".^$)*+?{}", c)) {
+      is_literal = 1;
+    }
+
+    // 2. Handle any quantifier after it. Those that allow zero repeats make the
+    //    token optional; `+` keeps it but ends the run.
+    int does_end_run = !is_literal;
+    if (c == '\0') {
+      // There's nothing after the end of the pattern.
+    } else if (*cursor == '*' || *cursor == '?' || *cursor == '+') {
+      if (*cursor != '+') is_literal = 0;
+      does_end_run = 1;
+      cursor++;
+    } else if (*cursor == '{' || c == '{') {
+      is_literal = 0;
+      does_end_run = 1;
+      while (*cursor && *cursor != '}') cursor++;
+      if (*cursor) cursor++;
+    }
+
+    // 3. Extend or end the current run.
+    if (is_literal) run[run_len++] = c;
+    if (does_end_run || c == '\0') {
+      if (run_len > best_len) {
+        memcpy(best, run, run_len);
+        best[best_len = run_len] = '\0';
+      }
+      run_len = 0;
+    }
+    if (c == '\0') break;
+  }
+
+  free(run);
+  if (best_len == 0) {
+    free(best);
+    return NULL;
+  }
+  return best;
+}
+
+void search__init_filter(search__Filter *filter, char *pattern, int flags) {
+  if (flags & matcher__literal) {
+    filter->literal = strdup(pattern);
+  } else {
+    filter->literal = search__find_literal(pattern);
+  }
+  // Signatures are case-sensitive, so they can't rule out case-blind matches.
+  filter->is_icase  = (flags & matcher__ignore_case) != 0;
+  filter->use_index = !filter->is_icase &&
+                      trigram__make_query(filter->literal, &filter->query);
+}
+
+int search__may_match(ed2__Editor *ed, search__Filter *filter,
+                      int64_t index) {
+  if (filter->literal == NULL) return 1;
+  if (filter->use_index && !trigram__may_contain(ed, index, &filter->query)) {
+    return 0;
+  }
+  char *line = line_text_at_index(ed, index);
+  size_t len = strlen(filter->literal);
+  return matcher__find_fixed(line, filter->literal, len, filter->is_icase)
+         != NULL;
+}
+
+void search__free_filter(search__Filter *filter) {
+  free(filter->literal);
+  filter->literal = NULL;
+}
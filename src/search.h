@@ -0,0 +1,51 @@
+// search.h
+//
+// Functions to find lines that match a regular expression.
+//
+
+#pragma once
+
+#include "ed2.h"
+#include "trigram.h"
+
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+// A filter quickly rules out lines that can't match a pattern; lines that pass
+// still need to be checked with the regex itself.
+typedef struct {
+  char *             literal;    // A required literal, or NULL if none is known.
+  int                is_icase;   // This is 1 iff `literal` may match any case.
+  int                use_index;  // This is 1 iff `query` is usable.
+  trigram__Signature query;
+} search__Filter;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This returns the line number of the first line of `ed` matching `pattern`,
+// starting at the line after `from_line` and wrapping around the buffer, so
+// that from_line itself is checked last. If is_backward is true, the search
+// moves toward line 1 instead, starting at the line before from_line. An empty
+// pattern reuses the last pattern searched for. If no line matches, or the
+// pattern is invalid, this reports an error to `ed` and returns 0.
+int64_t search__find_line(ed2__Editor *ed, char *pattern, int64_t from_line,
+                          int is_backward);
+
+// This returns a newly allocated string that every match of the extended
+// regular expression `pattern` must contain, or NULL if no such literal was
+// found. The caller owns the returned string. Lines that don't contain it can
+// be skipped without running the regex on them.
+char *  search__find_literal(char *pattern);
+
+// These set up, use, and release a filter for the given pattern, where `flags`
+// are the matcher__ flags the pattern is used with. search__may_match returns
+// 0 only if the line of `ed` at `index` can't match.
+void    search__init_filter(search__Filter *filter, char *pattern, int flags);
+int     search__may_match(ed2__Editor *ed, search__Filter *filter,
+                          int64_t index);
+void    search__free_filter(search__Filter *filter);
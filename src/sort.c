@@ -0,0 +1,165 @@
+// sort.c
+//
+
+// Header for this file.
+#include "sort.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+#include "ed2.h"
+
+// Standard includes.
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal types.
+
+// The keys are found once per line so that comparisons don't re-parse them.
+typedef struct {
+  char * line;
+  char * key;     // This points into line.
+  double number;  // The key's leading number, or 0; used in numeric mode.
+} SortItem;
+
+// This declares sort_item_array__item_ptr().
+array__declare_typed(sort_item_array, SortItem)
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+// Returns the start of the 1-based, whitespace-separated field `key_field`, or
+// the end of the line if the line has fewer fields.
+static char *find_key(char *line, int key_field) {
+  char *cursor = line;
+  while (isspace((unsigned char)*cursor)) cursor++;
+  for (int field = 1; field < key_field && *cursor; ++field) {
+    while (*cursor && !isspace((unsigned char)*cursor)) cursor++;
+    while (isspace((unsigned char)*cursor)) cursor++;
+  }
+  return cursor;
+}
+
+// Returns the number at the start of key; keys without one count as 0.
+static double leading_number(char *key) {
+  if (!isdigit((unsigned char)*key) && !strchr("+-.", *key)) return 0;
+  return strtod(key, NULL);
+}
+
+static int compare_items(void *flags_vp, const void *item1_vp,
+                         const void *item2_vp) {
+  sort__Flags *flags = (sort__Flags *)flags_vp;
+  SortItem    *item1 = (SortItem *)item1_vp;
+  SortItem    *item2 = (SortItem *)item2_vp;
+  int cmp;
+  if (flags->is_numeric) {
+    cmp = (item1->number > item2->number) - (item1->number < item2->number);
+  } else if (item1->key == item2->key) {
+    cmp = 0;  // With -d, equal lines are often the same string.
+  } else {
+    cmp = strcmp(item1->key, item2->key);
+  }
+  return flags->is_reversed ? -cmp : cmp;
+}
+
+// Returns a new Array of SortItems for the lines in [start, end].
+static Array new_sort_items(ed2__Editor *ed, int64_t start, int64_t end,
+                            sort__Flags *flags) {
+  Array items = array__new(end - start + 1, sizeof(SortItem));
+  array__add_zeroed_items(items, end - start + 1);
+  array__typed_for(sort_item_array, item, items, i) {
+    item->line = line_at_index(ed, start - 1 + i);
+    item->key  = find_key(item->line, flags->key_field);
+    if (flags->is_numeric) item->number = leading_number(item->key);
+  }
+  return items;
+}
+
+// Returns true iff the range is bad.
+static int err_if_bad_range(ed2__Editor *ed, int64_t start, int64_t end) {
+  if (start < 1 || end > last_line(ed) || start > end) {
+    ed2__error(ed, error__invalid_address);
+    return 1;
+  }
+  return 0;
+}
+
+static int num_threads() {
+  long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return num_cpus > 1 ? (int)num_cpus : 1;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+int sort__parse_flags(ed2__Editor *ed, char *command, sort__Flags *flags) {
+  flags->is_numeric  = 0;
+  flags->is_reversed = 0;
+  flags->key_field   = 1;
+  for (char *cursor = command; *cursor; ++cursor) {
+    if (*cursor == 'n') {
+      flags->is_numeric = 1;
+    } else if (*cursor == 'r') {
+      flags->is_reversed = 1;
+    } else if (*cursor == 'k' && isdigit((unsigned char)*(cursor + 1))) {
+      flags->key_field = (int)strtol(cursor + 1, &cursor, 10);
+      cursor--;  // Undo the loop's increment since strtol skipped the number.
+      if (flags->key_field < 1) {
+        ed2__error(ed, error__bad_cmd_suffix);
+        return 0;  // 0 = did not work
+      }
+    } else {
+      ed2__error(ed, error__bad_cmd_suffix);
+      return 0;  // 0 = did not work
+    }
+  }
+  return 1;  // 1 = did work
+}
+
+void sort__sort_lines(ed2__Editor *ed, int64_t start, int64_t end,
+                      sort__Flags flags) {
+  if (err_if_bad_range(ed, start, end)) return;
+
+  Array items = new_sort_items(ed, start, end, &flags);
+  array__parallel_sort(items, compare_items, &flags, num_threads());
+  array__typed_for(sort_item_array, item, items, i) {
+    line_at_index(ed, start - 1 + i) = item->line;
+  }
+  array__delete(items);
+
+  ed->current_line = end;
+}
+
+void sort__uniq_lines(ed2__Editor *ed, int64_t start, int64_t end,
+                      sort__Flags flags) {
+  if (err_if_bad_range(ed, start, end)) return;
+  flags.is_reversed = 0;
+
+  // Move each kept line to just after the previously kept one; the duplicates
+  // are swapped toward the end of the range, where we remove them together.
+  Array items = new_sort_items(ed, start, end, &flags);
+  SortItem *last_kept = NULL;
+  int64_t   num_kept  = 0;
+  array__typed_for(sort_item_array, item, items, i) {
+    if (last_kept && compare_items(&flags, last_kept, item) == 0) continue;
+    char **kept_slot = &line_at_index(ed, start - 1 + num_kept);
+    line_at_index(ed, start - 1 + i) = *kept_slot;
+    *kept_slot = item->line;
+    last_kept  = item;
+    num_kept++;
+  }
+  int64_t num_removed = (end - start + 1) - num_kept;
+  array__remove_items(ed->lines, start - 1 + num_kept, num_removed);
+  ed2__did_remove_lines(start - 1 + num_kept, num_removed);
+  array__delete(items);
+
+  int64_t new_end = end - num_removed;
+  if (ed->next_line > end)          ed->next_line -= num_removed;
+  else if (ed->next_line > new_end) ed->next_line  = new_end + 1;
+  ed->current_line = new_end;
+}
@@ -0,0 +1,45 @@
+// sort.h
+//
+// Functions to sort lines and to remove duplicate lines.
+//
+
+#pragma once
+
+#include "ed2.h"
+
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+typedef struct {
+  int is_numeric;   // Compare the leading numbers of keys instead of bytes.
+  int is_reversed;  // Sort in descending order.
+  int key_field;    // The 1-based field where the key starts.
+} sort__Flags;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This parses the suffix of a sort or uniq command into `flags`. The suffix
+// may contain any of these, in any order:
+//
+//  * n    Compare the leading numbers of the keys instead of their bytes.
+//  * r    Sort in reverse order; this is ignored when removing duplicates.
+//  * k<N> Use the line suffix starting at whitespace-separated field N as the
+//         key, where the first field is 1. By default the whole line is used.
+//
+// The return value is true iff the parse was successful.
+int  sort__parse_flags(ed2__Editor *ed, char *command, sort__Flags *flags);
+
+// This stably sorts the lines of `ed` in the range [start, end] by their keys.
+void sort__sort_lines(ed2__Editor *ed, int64_t start, int64_t end,
+                      sort__Flags flags);
+
+// This removes each line of `ed` in the range [start, end] whose key equals the
+// key of the line before it, keeping only the first line of each run of
+// duplicates.
+void sort__uniq_lines(ed2__Editor *ed, int64_t start, int64_t end,
+                      sort__Flags flags);
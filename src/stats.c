@@ -0,0 +1,115 @@
+// stats.c
+//
+
+// Header for this file.
+#include "stats.h"
+
+// Local includes.
+#include "ed2.h"
+
+// Standard includes.
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+int           stats__is_on = 0;
+stats__Counts stats__command;
+
+// The totals are indexed by command letter.
+static stats__Counts totals[256];
+
+static unsigned char command_letter;
+static double        command_start;
+static int           is_command_timed = 0;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static void add_counts(stats__Counts *sum, stats__Counts *counts) {
+  sum->num_commands    += counts->num_commands;
+  sum->seconds         += counts->seconds;
+  sum->num_lines       += counts->num_lines;
+  sum->num_matches     += counts->num_matches;
+  sum->match_seconds   += counts->match_seconds;
+  sum->num_undo_copies += counts->num_undo_copies;
+  sum->undo_bytes      += counts->undo_bytes;
+  sum->undo_seconds    += counts->undo_seconds;
+  sum->new_line_bytes  += counts->new_line_bytes;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+double stats__now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats__toggle() {
+  stats__is_on = !stats__is_on;
+}
+
+void stats__start_command(char *command) {
+  if (!stats__is_on || command == NULL) return;
+  memset(&stats__command, 0, sizeof(stats__command));
+  command_letter   = command[ed2__skip_range(command)];
+  command_start    = stats__now();
+  is_command_timed = 1;
+}
+
+void stats__end_command() {
+  if (!is_command_timed) return;
+  is_command_timed = 0;
+  if (!stats__is_on) return;  // This command turned timing off.
+
+  stats__Counts *c = &stats__command;
+  c->num_commands = 1;
+  c->seconds      = stats__now() - command_start;
+  add_counts(&totals[command_letter], c);
+
+  printf("time %.6fs, %" PRId64 " lines", c->seconds, c->num_lines);
+  if (c->num_matches) {
+    printf(", %" PRId64 " matches in %.6fs", c->num_matches, c->match_seconds);
+  }
+  if (c->num_undo_copies) {
+    printf(", %" PRId64 " undo copies of %" PRId64 " bytes in %.6fs",
+           c->num_undo_copies, c->undo_bytes, c->undo_seconds);
+  }
+  if (c->new_line_bytes) {
+    printf(", %" PRId64 " bytes of new lines", c->new_line_bytes);
+  }
+  printf("\n");
+}
+
+void stats__print_totals() {
+  printf("%-6s %8s %10s %10s %10s %10s %8s %12s %10s %12s\n",
+         "cmd", "count", "seconds", "lines", "matches", "match_s",
+         "undos", "undo_bytes", "undo_s", "new_bytes");
+  stats__Counts sum = { 0 };
+  for (int letter = 0; letter < 256; ++letter) {
+    stats__Counts *c = &totals[letter];
+    if (c->num_commands == 0) continue;
+    char name[8];
+    if (letter == '\0') strcpy(name, "(none)");
+    else                snprintf(name, sizeof(name), "%c", letter);
+    printf("%-6s %8" PRId64 " %10.4f %10" PRId64 " %10" PRId64 " %10.4f "
+           "%8" PRId64 " %12" PRId64 " %10.4f %12" PRId64 "\n",
+           name, c->num_commands, c->seconds, c->num_lines, c->num_matches,
+           c->match_seconds, c->num_undo_copies, c->undo_bytes,
+           c->undo_seconds, c->new_line_bytes);
+    add_counts(&sum, c);
+  }
+  printf("%-6s %8" PRId64 " %10.4f %10" PRId64 " %10" PRId64 " %10.4f "
+         "%8" PRId64 " %12" PRId64 " %10.4f %12" PRId64 "\n",
+         "all", sum.num_commands, sum.seconds, sum.num_lines, sum.num_matches,
+         sum.match_seconds, sum.num_undo_copies, sum.undo_bytes,
+         sum.undo_seconds, sum.new_line_bytes);
+}
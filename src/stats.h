@@ -0,0 +1,60 @@
+// stats.h
+//
+// Optional timing and counters for each command.
+//
+// The T command toggles timing. While it's on, each command is timed from when
+// it's read until the next one can be, and a line after its output gives its
+// time and counts of what it did: the lines it printed, added, removed or
+// rewrote; the regex or literal matches it ran and the time they took; the
+// undo copies it made, their bytes and time; and the bytes of new line text
+// it made. The S command prints these totals for each kind of command timed so
+// far, so it's easy to see whether a slow g spent its time matching, copying
+// the buffer for undo, or rewriting lines.
+//
+// Other modules add to stats__command only while stats__is_on is set, so the
+// counters cost a branch when timing is off.
+//
+
+#pragma once
+
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+typedef struct {
+  int64_t num_commands;
+  double  seconds;
+  int64_t num_lines;
+  int64_t num_matches;
+  double  match_seconds;
+  int64_t num_undo_copies;
+  int64_t undo_bytes;
+  double  undo_seconds;
+  int64_t new_line_bytes;
+} stats__Counts;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public globals.
+
+extern int           stats__is_on;
+extern stats__Counts stats__command;  // These are for the running command.
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This returns a monotonic time in seconds.
+double stats__now();
+
+// This turns timing on or off.
+void   stats__toggle();
+
+// These start and end timing `command`; the end prints its line of counts.
+void   stats__start_command(char *command);
+void   stats__end_command();
+
+// This prints the totals for each kind of command timed so far.
+void   stats__print_totals();
@@ -7,38 +7,63 @@
 // Local includes.
 #include "cstructs/cstructs.h"
 #include "ed2.h"
+#include "matcher.h"
+#include "progress.h"
+#include "search.h"
+#include "stats.h"
+#include "trace.h"
 
 // Standard includes.
 #include <assert.h>
 #include <regex.h>
+#include <stdint.h>
 #include <string.h>
 
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal types.
+
+// A replacement of the bytes at offsets [start, end) of a line.
+typedef struct {
+  size_t start;
+  size_t end;
+  char * full_repl;
+} Replacement;
+
 
 // ——————————————————————————————————————————————————————————————————————
 // Internal functions.
 
-// This accepts *line_ptr = <prefix> <match> <suffix> and <repl>, where <match>
-// has offsets [start, end). It allocates a new string just long enough to hold
-// <prefix> <repl> <suffix>, frees *line_ptr, and reassigns *line_ptr to the new
-// string.
-static void substring_repl(char **line_ptr, size_t start, size_t end,
-                           char *repl) {
-  assert(line_ptr && *line_ptr && repl);
-  int orig_line_len = strlen(*line_ptr);
-  assert(    0 <= start && start <  orig_line_len);
-  assert(start <= end   &&   end <= orig_line_len);
-
-  // The + 1 here is for the terminating null.
-  size_t new_size = orig_line_len - (end - start) + strlen(repl) + 1;
-  char *new_line = malloc(new_size);
-
-  // *line_ptr = <prefix> <match> <suffix>
-  memcpy(new_line, *line_ptr, start);             // new_line  = <prefix>
-  char *cursor = stpcpy(new_line + start, repl);  // new_line += <repl>
-  strcpy(cursor, *line_ptr + end);                // new_line += <suffix>
-
-  free(*line_ptr);
-  *line_ptr = new_line;
+// This accepts *line_ptr and an Array of non-overlapping Replacement items in
+// order of their offsets. It allocates a new string just long enough to hold
+// the line with every replacement made, frees *line_ptr and the full_repl
+// strings, and reassigns *line_ptr to the new string. Each byte of the old line
+// is copied once, however many replacements there are.
+static void substrings_repl(ed2__Editor *ed, char **line_ptr,
+                            Array replacements, size_t new_len) {
+  assert(line_ptr && *line_ptr && replacements);
+  char * new_line = malloc(new_len + 1);  // + 1 for the final null.
+  if (stats__is_on) {
+    stats__command.num_lines      += 1;
+    stats__command.new_line_bytes += new_len + 1;
+  }
+  char * cursor   = new_line;
+  size_t copied   = 0;  // This is how much of *line_ptr is in new_line.
+  array__for(Replacement *, repl, replacements, i) {
+    assert(copied <= repl->start && repl->start <= repl->end);
+    memcpy(cursor, *line_ptr + copied, repl->start - copied);
+    cursor = stpcpy(cursor + (repl->start - copied), repl->full_repl);
+    copied = repl->end;
+    free(repl->full_repl);
+  }
+  strcpy(cursor, *line_ptr + copied);
+
+  ed2__free_line(*line_ptr);
+  *line_ptr = ed2__share_line(ed, new_line);
 }
 
 // This expands a replacement string repl and a set of matches into a full
@@ -52,7 +77,10 @@ static size_t make_full_repl(char *repl, char *string, regmatch_t *matches,
                              char **full_repl) {
   size_t bytes_needed = 0;
   if (full_repl) {
+    trace__begin("size replacement");
     bytes_needed = make_full_repl(repl, string, matches, NULL);
+    trace__end();
+    trace__begin("copy replacement");
     *full_repl = malloc(bytes_needed);
   }
   char *out = full_repl ? *full_repl : NULL;
@@ -94,38 +122,69 @@ static size_t make_full_repl(char *repl, char *string, regmatch_t *matches,
     if (out) *out++ = *cursor;
   }
   if (out) *out = '\0';
+  if (full_repl) trace__end();
 
   return bytes_needed + 1;  // + 1 for the final null.
 }
 
 // Make the given substitution on the line with user-oriented (1-indexed) index
-// `line_num`, starting at `offset` characters into the line. This returns the
-// next offset to use for other non-overlapping substitutions on the same line,
-// or -1 if there was an error. If `err_str` is the empty string, it is updated
-// with a user-friendly error string in case of an error.
-static int substitute_on_line(regex_t *compiled_re, int line_num, int offset,
-                              char *repl, char *err_str) {
-  regmatch_t matches[max_matches];
-  int exec_flags = 0;
-  char *string = line_at_index(line_num - 1) + offset;
-  int err_code = regexec(compiled_re, string, max_matches, &matches[0],
-                         exec_flags);
-  if (err_code) {
-    // We'll save only the first-seen error.
-    if (err_code != REG_NOMATCH && err_str[0] == '\0') {
-      regerror(err_code, compiled_re, err_str, string_capacity);
+// `line_num`; if is_global is true, every non-overlapping match is replaced.
+// The matches are all found first and the new line is built in one pass, and
+// each search starts where the last match ended, so the time taken is linear
+// in the line length rather than in the length times the number of matches.
+// This returns 1 if anything matched and 0 otherwise. If `err_str` is the
+// empty string, it is updated with a user-friendly error string in case of an
+// error.
+static int substitute_on_line(ed2__Editor *ed, matcher__Matcher *matcher,
+                              int64_t line_num, char *repl, int is_global,
+                              char *err_str) {
+  // Cold lines are only thawed if they change.
+  char * line     = line_text_at_index(ed, line_num - 1);
+  size_t line_len = strlen(line);
+  size_t new_len  = line_len;
+  size_t offset   = 0;
+  size_t last_end = SIZE_MAX;  // This is where the previous match ended.
+  Array  replacements = array__new(4, sizeof(Replacement));
+  do {
+    // Each search sees the rest of the line as its own string, except that a
+    // '^' can't match after the start of the line.
+    regmatch_t matches[max_matches];
+    char *string = line + offset;
+    matches[0].rm_so = 0;
+    matches[0].rm_eo = line_len - offset;
+    int exec_flags = REG_STARTEND | (offset ? REG_NOTBOL : 0);
+    int err_code = matcher__exec(matcher, string, max_matches, &matches[0],
+                                 exec_flags);
+    if (err_code) {
+      // We'll save only the first-seen error.
+      if (err_code != REG_NOMATCH && err_str[0] == '\0') {
+        matcher__error(matcher, err_code, err_str);
+      }
+      break;
     }
-    return -1;
+    size_t start = offset + matches[0].rm_so;
+    size_t end   = offset + matches[0].rm_eo;
+    // An empty match right after the previous match isn't a new match, and an
+    // empty match is followed by a byte we keep so that the next search moves
+    // forward.
+    offset = (start == end) ? end + 1 : end;
+    if (start == end && start == last_end) continue;
+    last_end = end;
+
+    Replacement *replacement = array__new_ptr(replacements);
+    replacement->start = start;
+    replacement->end   = end;
+    make_full_repl(repl, string, &matches[0], &replacement->full_repl);
+    new_len += strlen(replacement->full_repl) - (end - start);
+  } while (is_global && offset <= line_len);
+
+  int did_match = (replacements->count > 0);
+  if (did_match) {
+    substrings_repl(ed, &line_at_index(ed, line_num - 1), replacements,
+                    new_len);
   }
-  char *full_repl;
-  make_full_repl(repl, string, &matches[0], &full_repl);
-  substring_repl(array__item_ptr(lines, line_num - 1),  // char ** to update
-                 matches[0].rm_so + offset,             // start offset
-                 matches[0].rm_eo + offset,             //   end offset
-                 full_repl);                            // replacement
-  int new_offset = matches[0].rm_so + offset + strlen(full_repl);
-  free(full_repl);
-  return new_offset;
+  array__delete(replacements);
+  return did_match;
 }
 
 
@@ -134,14 +193,15 @@ static int substitute_on_line(regex_t *compiled_re, int line_num, int offset,
 
 // This expects to receive a string of the form "/regex/repl/", which it parses
 // and places into pattern and repl, allocating new space for the copies. The
-// return value is true iff the parse was successful. The caller only needs to
-// call free on pattern and repl when the return value is true.
-int subst__parse_params(char *command, char **pattern, char **repl,
-                        int *is_global) {
+// suffix may have any of the letters `g`, `I` and `L`. The return value is true
+// iff the parse was successful. The caller only needs to call free on pattern
+// and repl when the return value is true.
+int subst__parse_params(ed2__Editor *ed, char *command, char **pattern,
+                        char **repl, int *is_global, int *match_flags) {
   char *cursor = command;
 
   if (*cursor != '/') {
-    ed2__error(error__no_slash_in_s_cmd);
+    ed2__error(ed, error__no_slash_in_s_cmd);
     return 0;  // 0 = did not work
   }
   cursor++;  // Skip the current '/'.
@@ -151,7 +211,7 @@ int subst__parse_params(char *command, char **pattern, char **repl,
   int p_start = cursor - command;
   while (*cursor && *cursor != '/') cursor++;
   if (*cursor == '\0') {
-    ed2__error(error__bad_regex_end);
+    ed2__error(ed, error__bad_regex_end);
     return 0;  // 0 = did not work
   }
   int p_end = cursor - command;
@@ -167,13 +227,21 @@ int subst__parse_params(char *command, char **pattern, char **repl,
   int r_end = cursor - command;
   int r_len = r_end - r_start;
 
-  // Check for a global flag.
-  *is_global = 0;
+  // Check for the global, case-insensitive and literal flags.
+  *is_global   = 0;
+  *match_flags = 0;
   if (*cursor) {
-    if (*(cursor + 1) == 'g') {
-      *is_global = 1;
-    } else if (*(cursor + 1) != '\0') {
-      ed2__error(error__bad_cmd_suffix);
+    cursor++;  // Skip the current '/'.
+    while (*cursor == 'g' || *cursor == 'I' || *cursor == 'L') {
+      if (*cursor == 'g') {
+        *is_global = 1;
+        cursor++;
+      } else {
+        matcher__parse_flags(&cursor, match_flags);
+      }
+    }
+    if (*cursor != '\0') {
+      ed2__error(ed, error__bad_cmd_suffix);
       return 0;  // 0 = did not work
     }
   }
@@ -187,36 +255,42 @@ int subst__parse_params(char *command, char **pattern, char **repl,
   return 1;  // 1 = did work
 }
 
-void subst__on_lines(char *pattern, char *repl,
-                     int start, int end, int is_global) {
-  regex_t compiled_re;
-  int compile_flags = REG_EXTENDED;
+void subst__on_lines(ed2__Editor *ed, char *pattern, char *repl,
+                     int64_t start, int64_t end, int is_global,
+                     int match_flags) {
+  matcher__Matcher matcher;
   char err_str[string_capacity];
   err_str[0] = '\0';
 
-  int err_code = regcomp(&compiled_re, pattern, compile_flags);
-  if (err_code) {
-    regerror(err_code, &compiled_re, err_str, string_capacity);
-    ed2__error(err_str);
-    // The man page at regex(3) doesn't make it clear if we should call regfree
-    // when regcomp has an error. However, looking at the source:
-    // http://www.opensource.apple.com/source/gcc/gcc-5659/libiberty/regex.c
-    // it's clear that calling regfree here is at very least safe, and in my
-    // estimation is the right thing to do:
-    regfree(&compiled_re);
+  trace__begin("compile");
+  int is_bad_pattern = matcher__compile(&matcher, pattern, match_flags,
+                                        err_str);
+  trace__end();
+  if (is_bad_pattern) {
+    ed2__error(ed, err_str);
+    matcher__free(&matcher);
     return;
   }
 
+  search__Filter filter;
+  search__init_filter(&filter, pattern, match_flags);
   int did_match_any = 0;
-  for (int i = start; i <= end; ++i) {
-    // j tracks the offset into the line for global matches; 0 = initial offset.
-    int j = substitute_on_line(&compiled_re, i, 0, repl, err_str);
-    if (j >= 0) did_match_any = 1;
-    while (is_global && j > 0) {
-      j = substitute_on_line(&compiled_re, i, j, repl, err_str);
+  trace__begin("substitute");
+  progress__start_loop("s", end - start + 1);
+  for (int64_t i = start; i <= end; ++i) {
+    if (progress__should_stop(i - start)) {
+      strcpy(err_str, error__interrupted);
+      break;
+    }
+    if (!search__may_match(ed, &filter, i - 1)) continue;
+    if (substitute_on_line(ed, &matcher, i, repl, is_global, err_str)) {
+      did_match_any = 1;
     }
   }
-  if (err_str[0] != '\0') ed2__error(err_str);
-  else if (!did_match_any) ed2__error(error__no_match);
-  regfree(&compiled_re);
+  progress__end_loop();
+  trace__end();
+  if (err_str[0] != '\0') ed2__error(ed, err_str);
+  else if (!did_match_any) ed2__error(ed, error__no_match);
+  search__free_filter(&filter);
+  matcher__free(&matcher);
 }
@@ -5,21 +5,29 @@
 
 #pragma once
 
+#include "ed2.h"
+
+#include <stdint.h>
+
 
 // ——————————————————————————————————————————————————————————————————————
 // Public functions.
 
 // This expects to receive a string of the form "/regex/repl/", which it parses
 // and places into pattern and repl, allocating new space for the copies. The
-// return value is true iff the parse was successful. The caller only needs to
-// call free on pattern and repl when the return value is true.
-int  subst__parse_params(char *command, char **pattern, char **repl,
-                         int *is_global);
+// suffix may have any of the letters `g`, `I` and `L`; `g` sets *is_global and
+// the others set matcher__ flags in *match_flags. The return value is true iff
+// the parse was successful. The caller only needs to call free on pattern and
+// repl when the return value is true.
+int  subst__parse_params(ed2__Editor *ed, char *command, char **pattern,
+                         char **repl, int *is_global, int *match_flags);
 
 // This substitutes matches of the given pattern with the given replacement
-// string `repl`. Only line numbers in the range [start, end] are affected. If
-// is_global is false, then only the first match in each line is affected; if
-// it's true, then every non-overlapping match is affected.
-void subst__on_lines(char *pattern, char *repl,
-                     int start, int end, int is_global);
+// string `repl` in the lines of `ed`. Only line numbers in the range [start,
+// end] are affected. If is_global is false, then only the first match in each
+// line is affected; if it's true, then every non-overlapping match is affected.
+// The pattern is matched as described by the matcher__ flags in `match_flags`.
+void subst__on_lines(ed2__Editor *ed, char *pattern, char *repl,
+                     int64_t start, int64_t end, int is_global,
+                     int match_flags);
 
@@ -0,0 +1,123 @@
+// trace.c
+//
+
+// Header for this file.
+#include "trace.h"
+
+// Standard includes.
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+int trace__is_on = 0;
+
+static FILE *          file;
+static int             pid;
+static int             num_events = 0;
+static struct timespec start_time;
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Each thread gets a small id the first time it traces an event.
+static pthread_key_t   thread_key;
+static intptr_t        num_threads = 0;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static double now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec  - start_time.tv_sec) * 1e6 +
+         (ts.tv_nsec - start_time.tv_nsec) / 1e3;
+}
+
+// This is expected to be called with file_lock held.
+static intptr_t thread_id() {
+  intptr_t id = (intptr_t)pthread_getspecific(thread_key);
+  if (id == 0) {
+    id = ++num_threads;
+    pthread_setspecific(thread_key, (void *)id);
+  }
+  return id;
+}
+
+// This starts an event's object with the fields every event has. It's expected
+// to be called with file_lock held.
+static void write_event_start(const char *phase) {
+  fprintf(file, "%s{\"ph\": \"%s\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f",
+          num_events++ ? ",\n" : "", phase, pid, (int)thread_id(), now_us());
+}
+
+static void write_json_string(const char *s) {
+  putc('"', file);
+  for (const unsigned char *c = (const unsigned char *)s; *c; ++c) {
+    if (*c == '"' || *c == '\\') fprintf(file, "\\%c", *c);
+    else if (*c < 0x20)          fprintf(file, "\\u%04x", *c);
+    else                         putc(*c, file);
+  }
+  putc('"', file);
+}
+
+// The closing bracket is optional in the format, so a trace cut short by a
+// crash can still be read, up to what was flushed.
+static void stop() {
+  fprintf(file, "\n]\n");
+  fclose(file);
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+int trace__start(char *path) {
+  file = fopen(path, "w");
+  if (file == NULL) return 0;
+  setvbuf(file, NULL, _IOFBF, 1 << 20);
+  pid = (int)getpid();
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  pthread_key_create(&thread_key, NULL);
+  fprintf(file, "[\n");
+  trace__is_on = 1;
+  trace__name_thread("main");
+  atexit(stop);
+  return 1;
+}
+
+void trace__begin_event(const char *name, const char *detail) {
+  pthread_mutex_lock(&file_lock);
+  write_event_start("B");
+  fprintf(file, ", \"name\": ");
+  write_json_string(name);
+  if (detail) {
+    fprintf(file, ", \"args\": {\"detail\": ");
+    write_json_string(detail);
+    putc('}', file);
+  }
+  putc('}', file);
+  pthread_mutex_unlock(&file_lock);
+}
+
+void trace__end_event() {
+  pthread_mutex_lock(&file_lock);
+  write_event_start("E");
+  putc('}', file);
+  pthread_mutex_unlock(&file_lock);
+}
+
+void trace__name_thread(const char *name) {
+  if (!trace__is_on) return;
+  pthread_mutex_lock(&file_lock);
+  write_event_start("M");
+  fprintf(file, ", \"name\": \"thread_name\", \"args\": {\"name\": ");
+  write_json_string(name);
+  fprintf(file, "}}");
+  pthread_mutex_unlock(&file_lock);
+}
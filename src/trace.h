@@ -0,0 +1,52 @@
+// trace.h
+//
+// Optional tracing of where time goes inside commands.
+//
+// With the -t option, begin and end events for the phases of each command are
+// written to the given file in the Chrome trace event format, which Perfetto
+// and chrome://tracing can show as a timeline per thread. The events include
+// each command line, each run of ed2__run_command, including those made by a
+// global command for each matching line, the passes of g and v, the sizing and
+// copying of s replacements, undo copies, loading and saving, and the work of
+// the I/O, save, decoding and trigram threads.
+//
+// Events nest by thread: an end event closes the latest open event of its
+// thread. The trace__begin and trace__end macros cost one branch when tracing
+// is off, so they're left in every build.
+//
+
+#pragma once
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public globals.
+
+extern int trace__is_on;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public macros.
+
+#define trace__begin(name) \
+    do { if (trace__is_on) trace__begin_event(name, NULL); } while (0)
+
+#define trace__end() \
+    do { if (trace__is_on) trace__end_event(); } while (0)
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// This starts writing events to `path`. It returns 0 if the file can't be
+// written.
+int  trace__start(char *path);
+
+// This begins an event on the calling thread. If `detail` isn't NULL, it's
+// shown with the event; the command line, for instance.
+void trace__begin_event(const char *name, const char *detail);
+
+// This ends the latest event begun on the calling thread.
+void trace__end_event();
+
+// This names the calling thread in the trace.
+void trace__name_thread(const char *name);
@@ -0,0 +1,201 @@
+// trigram.c
+//
+
+// Header for this file.
+#include "trigram.h"
+
+// Local includes.
+#include "cstructs/cstructs.h"
+#include "ed2.h"
+#include "trace.h"
+
+// Standard includes.
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DEBUG
+#include "cstructs/memprofile.h"
+#endif
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Constants and internal types.
+
+// The background builder lets the main thread in after this many lines.
+#define build_chunk_size 4096
+
+typedef struct {
+  char *             line;  // The line this signature was made for.
+  trigram__Signature sig;
+} Entry;
+
+// This declares entry_array__item_ptr().
+array__declare_typed(entry_array, Entry)
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Globals.
+
+static int is_enabled  = 0;
+static int is_building = 0;  // This is 1 while the builder thread is running.
+
+// Entry i describes line index i if its `line` pointer matches.
+static Array entries     = NULL;
+
+// These `char *` lines have been removed from `lines`; they're freed once no
+// entry can point to them.
+static Array freed_lines = NULL;
+
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Internal functions.
+
+static void add_trigram(trigram__Signature *sig, const char *trigram) {
+  unsigned char *bytes = (unsigned char *)trigram;
+  uint32_t h = ((uint32_t)bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+  h *= 0x9e3779b1u;
+  int bit = h >> 24;  // The top 8 bits choose one of the 256 bits.
+  sig->bits[bit / 64] |= ((uint64_t)1 << (bit % 64));
+}
+
+static trigram__Signature signature_of_string(char *str) {
+  trigram__Signature sig = {{0, 0, 0, 0}};
+  size_t len = strlen(str);
+  for (size_t i = 0; i + 3 <= len; ++i) add_trigram(&sig, str + i);
+  return sig;
+}
+
+// Returns the signature of the line at `index`, remaking it if needed.
+static trigram__Signature *signature_at(ed2__Editor *ed, int64_t index) {
+  if (index >= entries->count) {
+    array__add_zeroed_items(entries, ed->lines->count - entries->count);
+  }
+  Entry *entry = entry_array__item_ptr(entries, index);
+  char  *line  = line_id_at_index(ed, index);
+  if (entry->line != line) {
+    entry->line = line;
+    entry->sig  = signature_of_string(line_text_at_index(ed, index));
+  }
+  return &entry->sig;
+}
+
+static int is_out_of_date(ed2__Editor *ed) {
+  return freed_lines->count > 0 || entries->count != ed->lines->count;
+}
+
+// The builder checks every entry in one pass, letting the main thread in
+// between chunks. Lines freed before a pass started can't be in any entry once
+// the pass is done, so they're freed then. `ed_vptr` is the editor to index.
+static void *build_index(void *ed_vptr) {
+  ed2__Editor *ed = ed_vptr;
+  trace__name_thread("trigram");
+  pthread_mutex_lock(&index_lock);
+  trace__begin("build index");
+  while (is_out_of_date(ed)) {
+    int64_t num_to_free = freed_lines->count;
+    for (int64_t index = 0; index < ed->lines->count; ++index) {
+      if (index % build_chunk_size == 0) {
+        pthread_mutex_unlock(&index_lock);
+        sched_yield();
+        pthread_mutex_lock(&index_lock);
+        if (index >= ed->lines->count) break;
+      }
+      signature_at(ed, index);
+    }
+    if (entries->count > ed->lines->count) {
+      array__remove_items(entries, ed->lines->count,
+                          entries->count - ed->lines->count);
+    }
+    for (int64_t i = 0; i < num_to_free; ++i) {
+      free(array__item_val(freed_lines, i, char *));
+    }
+    if (num_to_free) array__remove_items(freed_lines, 0, num_to_free);
+  }
+  trace__end();
+  is_building = 0;
+  pthread_mutex_unlock(&index_lock);
+  return NULL;
+}
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+void trigram__enable() {
+  if (is_enabled) return;
+  entries     = array__new(64, sizeof(Entry));
+  freed_lines = array__new(64, sizeof(char *));
+  is_enabled  = 1;
+}
+
+void trigram__start_build(ed2__Editor *ed) {
+  if (!is_enabled) return;
+  // The entries parallel the lines, so edits near each other stay cheap in
+  // both when the lines are a gap buffer.
+  array__set_gap_buffer(entries, ed->lines->is_gap_buffer);
+  if (is_building || !is_out_of_date(ed)) return;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, build_index, ed) != 0) return;
+  pthread_detach(thread);
+  is_building = 1;
+}
+
+void trigram__lock() {
+  pthread_mutex_lock(&index_lock);
+}
+
+void trigram__unlock() {
+  pthread_mutex_unlock(&index_lock);
+}
+
+void trigram__free_line(char *line) {
+  if (!is_enabled) {
+    free(line);
+    return;
+  }
+  array__new_val(freed_lines, char *) = line;
+}
+
+void trigram__did_insert_lines(int64_t index, int64_t num_lines) {
+  if (!is_enabled || index > entries->count || num_lines <= 0) return;
+  array__insert_zeroed_items(entries, index, num_lines);
+}
+
+void trigram__did_relocate_line(int64_t index, char *old_line,
+                                char *new_line) {
+  if (!is_enabled || index >= entries->count) return;
+  Entry *entry = entry_array__item_ptr(entries, index);
+  if (entry->line == old_line) entry->line = new_line;
+}
+
+void trigram__did_remove_lines(int64_t index, int64_t num_lines) {
+  if (!is_enabled || index >= entries->count || num_lines <= 0) return;
+  if (index + num_lines > entries->count) num_lines = entries->count - index;
+  array__remove_items(entries, index, num_lines);
+}
+
+int trigram__make_query(char *literal, trigram__Signature *query) {
+  if (!is_enabled || literal == NULL || strlen(literal) < 3) return 0;
+  *query = signature_of_string(literal);
+  return 1;
+}
+
+int trigram__may_contain(ed2__Editor *ed, int64_t index,
+                         trigram__Signature *query) {
+  trigram__Signature *sig = signature_at(ed, index);
+  for (int i = 0; i < 4; ++i) {
+    if ((sig->bits[i] & query->bits[i]) != query->bits[i]) return 0;
+  }
+  return 1;
+}
+
+void trigram__add_memory_usage(memory__Usage *usage) {
+  if (!is_enabled) return;
+  memory__add_array(usage, entries);
+  memory__add_array(usage, freed_lines);
+  array__for(char **, line, freed_lines, i) memory__add_string(usage, *line);
+}
@@ -0,0 +1,75 @@
+// trigram.h
+//
+// An optional index that narrows down which lines may contain a literal.
+//
+// Each line gets a 256-bit signature with one bit set per trigram (three
+// consecutive bytes) in the line. A line can only contain a literal if its
+// signature has every bit of the literal's signature, so most lines that lack
+// the literal are ruled out without reading them or running a regex.
+//
+// Signatures are kept in an array parallel to `lines`, and each one records
+// the line pointer it was made for. A signature whose pointer doesn't match the
+// line now at its index is simply remade, so edits can never leave a wrong
+// signature in use; the edit hooks below only keep signatures lined up so they
+// don't need remaking. While the index is on, freed lines are held until no
+// signature refers to them, so a new line can't reuse a described address.
+//
+// After each command that changes `lines`, a background thread checks every
+// signature and frees the held lines. The main thread holds the index lock
+// while it runs commands.
+//
+
+#pragma once
+
+#include "ed2.h"
+#include "memory.h"
+
+#include <stdint.h>
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public types.
+
+typedef struct {
+  uint64_t bits[4];
+} trigram__Signature;
+
+
+// ——————————————————————————————————————————————————————————————————————
+// Public functions.
+
+// The index is off until this is called.
+void trigram__enable();
+
+// If the index is on and out of date, this starts bringing it up to date with
+// the lines of `ed` on a background thread. It's expected to be called with the
+// lock held.
+void trigram__start_build(ed2__Editor *ed);
+
+void trigram__lock();
+void trigram__unlock();
+
+// This frees a line that is no longer in `lines`, possibly later.
+void trigram__free_line(char *line);
+
+// These keep signatures lined up with `lines` as lines are added or removed.
+void trigram__did_insert_lines(int64_t index, int64_t num_lines);
+void trigram__did_remove_lines(int64_t index, int64_t num_lines);
+
+// This keeps the signature of the line at `index` when its item in `lines`
+// changes from `old_line` to `new_line` with the same text.
+void trigram__did_relocate_line(int64_t index, char *old_line, char *new_line);
+
+// This sets up `query` for finding lines that contain `literal`. It returns 0
+// if the index can't help, such as when the index is off or literal is NULL or
+// shorter than a trigram; the query is not usable in that case.
+int  trigram__make_query(char *literal, trigram__Signature *query);
+
+// This returns 0 if the line of `ed` at `index` can't contain the query's
+// literal; otherwise 1.
+int  trigram__may_contain(ed2__Editor *ed, int64_t index,
+                          trigram__Signature *query);
+
+// This adds the signatures, and the removed lines waiting to be freed, to
+// `usage`. It's expected to be called with the lock held.
+void trigram__add_memory_usage(memory__Usage *usage);